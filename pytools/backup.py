@@ -49,6 +49,9 @@ def get_argparser() -> Namespace:
     parser.add_argument("--file", type=str, default="gpg_backup",
                         help="Backup/Restore file (default is '%(default)s')")
 
+    parser.add_argument("--archive", action="store_true",
+                        help="Backup/Restore all slots at once, as an encrypted device archive")
+
     parser.add_argument("--seed-key", action="store_true",
                         help="After Restore, regenerate all keys, based on seed mode")
 
@@ -97,7 +100,15 @@ def entrypoint() -> None:
 
         gpgcard.get_all()
 
-        if args.restore:
+        if args.archive:
+            if args.restore:
+                gpgcard.restore_archive(args.file)
+                print(f"Device archive restored from file '{args.file}'.")
+            else:
+                gpgcard.backup_archive(args.file)
+                print(f"Device archive saved in file '{args.file}'.")
+
+        elif args.restore:
             gpgcard.restore(args.file)
             print(f"Configuration restored from file '{args.file}'.")
 
@@ -22,7 +22,8 @@ import os
 from datetime import datetime, timezone
 import json
 from hashlib import sha1
-from typing import Optional, Tuple
+from typing import Iterator, List, Optional, Tuple
+from contextlib import contextmanager
 from dataclasses import dataclass, field
 # pylint: disable=import-error
 from Crypto.PublicKey.RSA import construct
@@ -34,6 +35,29 @@ from gpgapp.gpgcmd import KEY_OPERATIONS, KEY_TEMPLATES, USER_SALUTATION  # type
 
 APDU_MAX_SIZE: int = 0xFE
 APDU_CHAINING_MODE: int = 0x10
+# Bulk PUT DATA container: largest size, and Data Objects it accepts
+BULK_MAX_SIZE: int = 800
+BULK_MAX_DO: int = 32
+BULK_DATA_OBJECTS = (
+    DataObject.DO_AID,
+    DataObject.DO_CARD_NAME,
+    DataObject.DO_LOGIN,
+    DataObject.DO_CARD_LANG,
+    DataObject.DO_CARD_SALUTATION,
+    DataObject.DO_URL,
+    DataObject.DO_SIG_ATTR,
+    DataObject.DO_DEC_ATTR,
+    DataObject.DO_AUT_ATTR,
+    DataObject.DO_FINGERPRINT_WR_SIG,
+    DataObject.DO_FINGERPRINT_WR_DEC,
+    DataObject.DO_FINGERPRINT_WR_AUT,
+    DataObject.DO_CA_FINGERPRINT_WR_SIG,
+    DataObject.DO_CA_FINGERPRINT_WR_DEC,
+    DataObject.DO_CA_FINGERPRINT_WR_AUT,
+    DataObject.DO_DATES_WR_SIG,
+    DataObject.DO_DATES_WR_DEC,
+    DataObject.DO_DATES_WR_AUT,
+)
 
 
 class GPGCardExcpetion(Exception):
@@ -148,6 +172,8 @@ class GPGCard() :
         self.data: CardInfo = CardInfo()
         self.data.reset()
         self._last_sent_was_key_read: bool = False
+        self._bulk: Optional[List[Tuple[int, bytes]]] = None
+        self.state_counter: Optional[int] = None
 
     def connect(self, device: str) -> None:
         """Connect to the selected Reader
@@ -160,6 +186,7 @@ class GPGCard() :
             self.transport = Transport("tcp", server="127.0.0.1", port=9999, debug=False)
         else:
             self.transport = Transport("hid")
+        self.state_counter = None
         print("")
 
 
@@ -245,8 +272,23 @@ class GPGCard() :
 
 
     ############### API interfaces ###############
-    def get_all(self) -> None:
-        """Retrieve all Data Object values from the Card"""
+    def get_all(self, force: bool = False) -> None:
+        """Retrieve all Data Object values from the Card
+        Skipped when the card state counter did not change since the last call
+
+        Args:
+            force (bool): Read all Data Objects, whatever the state counter
+        """
+
+        counter = self.get_state_counter()
+        if not force and counter is not None and counter == self.state_counter:
+            # Only the PIN retry and signature counters can have changed
+            self.data.PW_status               = self._get_data(DataObject.DO_PW_STATUS)
+            tags                              = self._decode_tlv(self._get_data(DataObject.DO_SEC_TEMPL))
+            if DataObject.DO_SIG_COUNT in tags:
+                self.data.digital_counter     = self._get_int(tags[DataObject.DO_SIG_COUNT], 3)
+            return
+        self.state_counter = counter
 
         self.data.reset()
         data: Optional[bytes] = b""
@@ -481,6 +523,52 @@ class GPGCard() :
         self._put_data(DataObject.DO_AUT_KEY, self.data.aut.key)
 
 
+    def backup_archive(self, file_name: str) -> None:
+        """Backup all slots and config in an encrypted device archive
+
+        Args:
+            file_name (str): Archive filename
+        """
+
+        apdu = bytes.fromhex(f"00CA{DataObject.CMD_ARCHIVE:04x}00")
+        resp, sw = self._exchange(apdu)
+        if sw != ErrorCodes.ERR_SUCCESS:
+            raise GPGCardExcpetion(sw, "Archive backup failed")
+        fd = os.open(file_name, os.O_WRONLY | os.O_CREAT | os.O_TRUNC, 0o600)
+        with os.fdopen(fd, mode="wb") as f:
+            f.write(resp)
+
+
+    @contextmanager
+    def bulk_put(self) -> Iterator[None]:
+        """Group the Data Objects written in the block, in bulk containers
+        They are checked then written by the card when leaving the block,
+        nothing is written when the block raises
+        """
+
+        self._bulk = []
+        try:
+            yield
+            bulk, self._bulk = self._bulk, None
+            self._put_bulk(bulk)
+        finally:
+            self._bulk = None
+
+
+    def restore_archive(self, file_name: str) -> None:
+        """Restore all slots and config from an encrypted device archive
+
+        Args:
+            file_name (str): Archive filename
+        """
+
+        with open(file_name, mode="rb") as f:
+            data = f.read()
+        sw = self._put_data(DataObject.CMD_ARCHIVE, data)
+        if sw != ErrorCodes.ERR_SUCCESS:
+            raise GPGCardExcpetion(sw, "Archive restore failed")
+
+
     def export_pub_key(self, pubkey: dict, file_name: str) -> None:
         """Export a Public key to file
 
@@ -729,6 +817,19 @@ class GPGCard() :
         self.data.name = name
         self._put_data(DataObject.DO_CARD_NAME, name.encode("utf-8"))
 
+    def get_state_counter(self) -> Optional[int]:
+        """Get the card state counter
+
+        Returns:
+            Counter value, None if not supported by the card
+        """
+
+        resp, sw = self._exchange(bytes.fromhex(f"00CA{DataObject.CMD_STATE_COUNTER:04x}00"))
+        if sw != ErrorCodes.ERR_SUCCESS or len(resp) != 4:
+            return None
+        return self._get_int(resp, 4)
+
+
     def get_name(self) -> str:
         """Get the Card User name"""
 
@@ -1189,6 +1290,40 @@ class GPGCard() :
         raise GPGCardExcpetion(ErrorCodes.ERR_INTERNAL, f"Invalid key type {key}!")
 
 
+    def get_challenge(self, size: int) -> bytes:
+        """Get random bytes from the card
+
+        Args:
+            size (int): Number of bytes, up to 1024 (P2 is the length high byte)
+
+        Return:
+            Random bytes
+        """
+
+        apdu = bytes.fromhex(f"008400{(size >> 8) & 0xFF:02x}{size & 0xFF:02x}")
+        resp, sw = self._exchange(apdu)
+        if sw != ErrorCodes.ERR_SUCCESS:
+            raise GPGCardExcpetion(sw, "")
+        return resp
+
+
+    def sign(self, data: bytes) -> bytes:
+        """Compute a Digital Signature with the SIG key
+
+        Args:
+            data (bytes): Data to sign (DigestInfo for RSA, hash for ECC)
+
+        Return:
+            Signature
+        """
+
+        apdu = bytes.fromhex("002a9e9a")
+        resp, sw = self._exchange(apdu, data)
+        if sw != ErrorCodes.ERR_SUCCESS:
+            raise GPGCardExcpetion(sw, "")
+        return resp
+
+
     def _get_data(self, tag: int, bnext: bool = False) -> bytes:
         """Send APDU command to GET a specific Data Object
 
@@ -1207,6 +1342,7 @@ class GPGCard() :
 
     def _put_data(self, tag: int, data: bytes) -> int:
         """Send APDU command to PUT a Data Object value
+        Inside a bulk_put block, the value is queued instead
 
         Args:
             tag (int):    Data Object tag
@@ -1216,11 +1352,47 @@ class GPGCard() :
             Status Word
         """
 
+        if self._bulk is not None and tag in BULK_DATA_OBJECTS:
+            self._bulk.append((tag, data))
+            return ErrorCodes.ERR_SUCCESS
         apdu = bytes.fromhex(f"00DA{tag:04x}")
         _, sw = self._exchange(apdu, data)
         return sw
 
 
+    def _put_bulk(self, bulk: List[Tuple[int, bytes]]) -> None:
+        """Send queued Data Objects in as few bulk containers as possible
+
+        Args:
+            bulk (list): Data Objects tag and value
+        """
+
+        containers: List[List[bytes]] = [[]]
+        tags: List[int] = []
+        for tag, data in bulk:
+            if len(data) < 0x80:
+                length = len(data).to_bytes(1, "big")
+            elif len(data) < 0x100:
+                length = b"\x81" + len(data).to_bytes(1, "big")
+            else:
+                length = b"\x82" + len(data).to_bytes(2, "big")
+            do = tag.to_bytes(2, "big") + length + data
+            # a container can't hold the same DO twice
+            if (tag in tags or len(tags) == BULK_MAX_DO or
+                    len(b"".join(containers[-1])) + len(do) > BULK_MAX_SIZE):
+                containers.append([])
+                tags = []
+            containers[-1].append(do)
+            tags.append(tag)
+
+        for container in containers:
+            if not container:
+                continue
+            sw = self._put_data(DataObject.CMD_BULK_DATA, b"".join(container))
+            if sw != ErrorCodes.ERR_SUCCESS:
+                raise GPGCardExcpetion(sw, "Bulk PUT DATA failed")
+
+
     def _asym_key_pair(self, op: int, key: int, seed: bool = False) -> dict:
         """Asymmetric key pair operation
 
@@ -134,6 +134,14 @@ class DataObject(IntEnum):
     CMD_SLOT_CUR = 0x01F2
     # [Read/Write] RSA Exponent
     CMD_RSA_EXP = 0x01F8
+    # [Read/Write] Encrypted device archive (all slots and config)
+    CMD_ARCHIVE = 0x01FA
+    # [Read/Write] ECDH secret cache size and hit/miss counters
+    CMD_ECDH_CACHE = 0x01FB
+    # [Write] Bulk container of Data Objects
+    CMD_BULK_DATA = 0x01FC
+    # [Read] Card state counter, bumped by each state change
+    CMD_STATE_COUNTER = 0x01FD
 
     # [Read] Full Application identifier (AID), ISO 7816-4
     DO_AID = 0x4F
@@ -18,6 +18,7 @@
 #*****************************************************************************
 
 import sys
+import time
 from pathlib import Path
 from argparse import ArgumentParser, RawTextHelpFormatter, Namespace
 from gpgapp.gpgcard import GPGCard, GPGCardExcpetion
@@ -80,6 +81,11 @@ def get_argparser() -> Namespace:
     parser.add_argument("--file", type=str, default="pubkey",
                         help="Public Key export file (default is '%(default)s')")
 
+    parser.add_argument("--bench-challenge", type=int, metavar="SIZE",
+                        help="Measure GET CHALLENGE throughput with SIZE bytes requests (up to 1024)")
+    parser.add_argument("--bench-sign", type=int, metavar="COUNT",
+                        help="Measure the SIG key signature latency over COUNT signatures")
+
     return parser.parse_args()
 
 
@@ -101,6 +107,54 @@ def error(code: int, msg: str) -> None:
     sys.exit()
 
 
+# ===============================================================================
+#          GET CHALLENGE throughput
+# ===============================================================================
+def bench_challenge(gpgcard: GPGCard, size: int, count: int = 32) -> None:
+    """Measure the random generation throughput
+
+    Args:
+        gpgcard (GPGCard): Card instance
+        size (int): Length of each request
+        count (int): Number of requests
+    """
+
+    start = time.perf_counter()
+    for _ in range(count):
+        gpgcard.get_challenge(size)
+    elapsed = time.perf_counter() - start
+    print(f"GET CHALLENGE: {count} x {size} bytes in {elapsed:.2f}s, " \
+          f"{(count * size) / elapsed:.0f} bytes/s")
+
+
+# ===============================================================================
+#          PSO:CDS latency
+# ===============================================================================
+def bench_sign(gpgcard: GPGCard, user_pin: str, pinpad: bool, count: int) -> None:
+    """Measure the signature latency of the SIG key
+
+    Args:
+        gpgcard (GPGCard): Card instance
+        user_pin (str): User pin code, verified again before each signature
+        pinpad (bool): Indicates to use pinpad
+        count (int): Number of signatures
+    """
+
+    # SHA-256 DigestInfo of an empty message
+    digest_info = bytes.fromhex("3031300d060960864801650304020105000420" \
+                                "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855")
+    elapsed = 0.0
+    sig = b""
+    for _ in range(count):
+        # PW1 may be valid for one signature only
+        gpgcard.verify_pin(PassWord.PW1, user_pin, pinpad)
+        start = time.perf_counter()
+        sig = gpgcard.sign(digest_info)
+        elapsed += time.perf_counter() - start
+    print(f"PSO:CDS: {count} x {len(sig)} bytes signatures in {elapsed:.2f}s, " \
+          f"{1000 * elapsed / count:.0f} ms/signature")
+
+
 # ===============================================================================
 #          PIN codes verification
 # ===============================================================================
@@ -329,6 +383,10 @@ def entrypoint() -> None:
 
     if args.key_action == "Export" and not args.file:
         error(ErrorCodes.ERR_INTERNAL, "Provide a file to export public key")
+    if args.bench_challenge is not None and not 0 < args.bench_challenge <= 1024:
+        error(ErrorCodes.ERR_INTERNAL, "Challenge size must be between 1 and 1024")
+    if args.bench_sign is not None and args.bench_sign <= 0:
+        error(ErrorCodes.ERR_INTERNAL, "Signature count must be positive")
 
     # Processing
     # ----------
@@ -343,16 +401,17 @@ def entrypoint() -> None:
         if args.slot:
             gpgcard.select_slot(args.slot - 1)
 
-        if args.salutation:
-            gpgcard.set_salutation(args.salutation)
-        if args.name:
-            gpgcard.set_name(args.name)
-        if args.url:
-            gpgcard.set_url(args.url)
-        if args.login:
-            gpgcard.set_login(args.login)
-        if args.lang:
-            gpgcard.set_lang(args.lang)
+        with gpgcard.bulk_put():
+            if args.salutation:
+                gpgcard.set_salutation(args.salutation)
+            if args.name:
+                gpgcard.set_name(args.name)
+            if args.url:
+                gpgcard.set_url(args.url)
+            if args.login:
+                gpgcard.set_login(args.login)
+            if args.lang:
+                gpgcard.set_lang(args.lang)
 
         if args.new_user_pin:
             gpgcard.change_pin(PassWord.PW1, args.user_pin, args.new_user_pin)
@@ -371,20 +430,26 @@ def entrypoint() -> None:
             reset_app(gpgcard)
 
         if args.set_templates:
-            set_templates(gpgcard, args.set_templates, args.key_type)
+            with gpgcard.bulk_put():
+                set_templates(gpgcard, args.set_templates, args.key_type)
 
         if args.seed_key and not args.key_action:
             gpgcard.seed_key()
 
-        if args.set_fingerprints:
-            set_fingerprints(gpgcard, args.set_fingerprints, args.key_type)
-
-        if args.serial:
-            gpgcard.set_serial(args.serial)
+        with gpgcard.bulk_put():
+            if args.set_fingerprints:
+                set_fingerprints(gpgcard, args.set_fingerprints, args.key_type)
+            if args.serial:
+                gpgcard.set_serial(args.serial)
 
         if args.key_action:
             handle_key(gpgcard, args.key_action, args.key_type, args.file, args.seed_key)
 
+        if args.bench_challenge:
+            bench_challenge(gpgcard, args.bench_challenge)
+        if args.bench_sign:
+            bench_sign(gpgcard, args.user_pin, args.pinpad, args.bench_sign)
+
         gpgcard.disconnect()
 
     except GPGCardExcpetion as err:
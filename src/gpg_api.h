@@ -29,6 +29,11 @@ unsigned int gpg_curve2domainlen(unsigned int cv);
 
 void gpg_init(void);
 void gpg_install(unsigned char app_state);
+void gpg_install_slot(gpg_key_slot_t *slot);
+gpg_key_slot_t *gpg_install_slot_get(unsigned int slot);
+void gpg_install_key_invalidate(gpg_key_t *keygpg);
+void gpg_install_restore_failed(void);
+void gpg_state_counter_bump(void);
 
 /* ----------------------------------------------------------------------- */
 /* ---                            DISPATCH                            ---- */
@@ -43,9 +48,28 @@ int gpg_dispatch(void);
 void gpg_apdu_select_data(unsigned int ref, int record);
 int gpg_apdu_get_data(unsigned int ref);
 int gpg_apdu_get_next_data(unsigned int ref);
+int gpg_apdu_get_data_slice(unsigned int ref);
 int gpg_apdu_put_data(unsigned int ref);
+void gpg_data_bulk_replay(void);
 int gpg_apdu_get_key_data(unsigned int ref);
 int gpg_apdu_put_key_data(unsigned int ref);
+int gpg_data_stream_start(void);
+void gpg_data_stream_chunk(const unsigned char *chunk, unsigned int len);
+int gpg_data_stream_next(void);
+void gpg_data_stream_end(void);
+
+/* ----------------------------------------------------------------------- */
+/* ---                              HEAP                              ---- */
+/* ----------------------------------------------------------------------- */
+
+unsigned int gpg_heap_get(unsigned int handle, const unsigned char **value);
+int gpg_heap_put(unsigned int handle, const unsigned char *value, unsigned int len);
+void gpg_heap_drop_slot(unsigned int slot);
+unsigned int gpg_heap_available(void);
+void gpg_heap_check(void);
+void gpg_heap_stream_start(unsigned int handle, unsigned int max);
+void gpg_heap_stream_chunk(const unsigned char *chunk, unsigned int len);
+int gpg_heap_stream_commit(void);
 
 /* ----------------------------------------------------------------------- */
 /* ---                              PSO                               ---- */
@@ -59,12 +83,20 @@ int gpg_pso_derive_key_seed(unsigned char *Sn,
                             unsigned int Ski_len);
 int gpg_apdu_pso(void);
 int gpg_apdu_internal_authenticate(void);
+void gpg_pso_uif_reset(const gpg_key_t *key);
+void gpg_pso_uif_tick(void);
+int gpg_pso_batch_next(void);
+void gpg_pso_batch_end(void);
+void gpg_pso_ecdh_cache_clear(void);
+void gpg_pso_aes_stream_reset(void);
+void gpg_pso_ecdh_cache_config(unsigned int size);
 
 /* ----------------------------------------------------------------------- */
 /* ---                              GEN                               ---- */
 /* ----------------------------------------------------------------------- */
 
 int gpg_apdu_gen(void);
+void gpg_gen_pub_invalidate(const gpg_key_t *keygpg);
 
 /* ----------------------------------------------------------------------- */
 /* ---                           CHALLENGE                            ---- */
@@ -104,6 +136,10 @@ int gpg_apdu_mse();
 /* ----------------------------------------------------------------------- */
 void gpg_io_discard(int clear);
 void gpg_io_clear(void);
+void gpg_io_taint(void);
+unsigned int gpg_io_scratch_mark(void);
+void *gpg_io_scratch_alloc(unsigned int len);
+void gpg_io_scratch_release(unsigned int mark);
 void gpg_io_set_offset(unsigned int offset);
 void gpg_io_mark(void);
 void gpg_io_rewind(void);
@@ -116,6 +152,8 @@ void gpg_io_insert_u8(unsigned int v8);
 void gpg_io_insert_t(unsigned int T);
 void gpg_io_insert_tl(unsigned int T, unsigned int L);
 void gpg_io_insert_tlv(unsigned int T, unsigned int L, unsigned char const *V);
+void gpg_io_insert_nvm(unsigned char const *value, unsigned int len);
+void gpg_io_slice(unsigned int off, unsigned int len);
 
 void gpg_io_fetch_buffer(unsigned char *buffer, unsigned int len);
 unsigned int gpg_io_fetch_u32(void);
@@ -18,6 +18,144 @@
 #include "gpg_vars.h"
 #include "cx_errors.h"
 
+/**
+ * HMAC-SHA256 over the concatenation of V, an optional separator and data
+ *
+ * @param[in]  key HMAC key (32 bytes)
+ * @param[in]  sep separator byte, or -1 for none
+ * @param[in]  data additional data, may be NULL
+ * @param[in]  len data length
+ * @param[out] mac HMAC output (32 bytes)
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_drbg_hmac(const unsigned char *key,
+                              int sep,
+                              const unsigned char *data,
+                              unsigned int len,
+                              unsigned char *mac) {
+    cx_hmac_sha256_t hmac;
+    unsigned char s;
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    CX_CHECK(cx_hmac_sha256_init_no_throw(&hmac, key, 32));
+    CX_CHECK(cx_hmac_no_throw((cx_hmac_t *) &hmac, 0, G_gpg_vstate.drbg.V, 32, NULL, 0));
+    if (sep >= 0) {
+        s = sep;
+        CX_CHECK(cx_hmac_no_throw((cx_hmac_t *) &hmac, 0, &s, 1, NULL, 0));
+    }
+    CX_CHECK(cx_hmac_no_throw((cx_hmac_t *) &hmac, CX_LAST, data, len, mac, 32));
+
+end:
+    explicit_bzero(&hmac, sizeof(hmac));
+    return error;
+}
+
+/**
+ * HMAC-DRBG update function (NIST SP 800-90A)
+ *
+ * @param[in] data provided data, may be NULL
+ * @param[in] len data length
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_drbg_update(const unsigned char *data, unsigned int len) {
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    CX_CHECK(gpg_drbg_hmac(G_gpg_vstate.drbg.K, 0x00, data, len, G_gpg_vstate.drbg.K));
+    CX_CHECK(gpg_drbg_hmac(G_gpg_vstate.drbg.K, -1, NULL, 0, G_gpg_vstate.drbg.V));
+    if (len != 0) {
+        CX_CHECK(gpg_drbg_hmac(G_gpg_vstate.drbg.K, 0x01, data, len, G_gpg_vstate.drbg.K));
+        CX_CHECK(gpg_drbg_hmac(G_gpg_vstate.drbg.K, -1, NULL, 0, G_gpg_vstate.drbg.V));
+    }
+
+end:
+    return error;
+}
+
+/**
+ * Generate random bytes from the HMAC-DRBG
+ * The DRBG is (re)seeded from the device TRNG when needed
+ *
+ * @param[out] out random bytes
+ * @param[in]  len number of bytes
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_drbg_generate(unsigned char *out, unsigned int len) {
+    unsigned char seed[48];
+    unsigned int n;
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    if ((G_gpg_vstate.drbg.reseed_counter == 0) ||
+        (G_gpg_vstate.drbg.reseed_counter > GPG_DRBG_RESEED_INTERVAL)) {
+        // entropy input and nonce
+        cx_rng(seed, sizeof(seed));
+        if (G_gpg_vstate.drbg.reseed_counter == 0) {
+            memset(G_gpg_vstate.drbg.K, 0x00, sizeof(G_gpg_vstate.drbg.K));
+            memset(G_gpg_vstate.drbg.V, 0x01, sizeof(G_gpg_vstate.drbg.V));
+        }
+        CX_CHECK(gpg_drbg_update(seed, sizeof(seed)));
+        G_gpg_vstate.drbg.reseed_counter = 1;
+    }
+
+    while (len != 0) {
+        CX_CHECK(gpg_drbg_hmac(G_gpg_vstate.drbg.K, -1, NULL, 0, G_gpg_vstate.drbg.V));
+        n = MIN(len, sizeof(G_gpg_vstate.drbg.V));
+        memmove(out, G_gpg_vstate.drbg.V, n);
+        out += n;
+        len -= n;
+    }
+    CX_CHECK(gpg_drbg_update(NULL, 0));
+    G_gpg_vstate.drbg.reseed_counter++;
+
+end:
+    explicit_bzero(seed, sizeof(seed));
+    if (error != CX_OK) {
+        // force a new instantiation
+        explicit_bzero(G_gpg_vstate.drbg.K, sizeof(G_gpg_vstate.drbg.K));
+        G_gpg_vstate.drbg.reseed_counter = 0;
+    }
+    return error;
+}
+
+/**
+ * Init the seeded random hash with the derived secret
+ * The BIP32 derivation is only done once per session
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_drbg_seeded_init(void) {
+    unsigned int path[2];
+    unsigned char chain[32] = {0};
+    unsigned char Sr[64];
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    if (G_gpg_vstate.drbg.seeded_ready) {
+        return CX_OK;
+    }
+    path[0] = 0x80475047;
+    path[1] = 0x0F0F0F0F;
+    CX_CHECK(os_derive_bip32_no_throw(CX_CURVE_SECP256K1, path, 2, Sr, chain));
+    chain[0] = 'r';
+    chain[1] = 'n';
+    chain[2] = 'd';
+
+    cx_sha256_init(&G_gpg_vstate.drbg.seeded);
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.drbg.seeded, 0, Sr, 32, NULL, 0));
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.drbg.seeded, 0, chain, 3, NULL, 0));
+    G_gpg_vstate.drbg.seeded_ready = 1;
+
+end:
+    explicit_bzero(Sr, sizeof(Sr));
+    explicit_bzero(chain, sizeof(chain));
+    return error;
+}
+
 /**
  * Generate a Random Number
  *
@@ -27,10 +165,19 @@
 int gpg_apdu_get_challenge() {
     unsigned int olen;
     cx_err_t error = CX_INTERNAL_ERROR;
-    unsigned char Sr[64];
+    unsigned int mark = gpg_io_scratch_mark();
+    cx_sha256_t *sha256;
+    cx_sha3_t *sha3;
+    unsigned char *H;
 
     switch (G_gpg_vstate.io_p1) {
         case CHALLENGE_NOMINAL:
+            // Ledger Add-on: P2 is the length high byte
+            olen = (G_gpg_vstate.io_p2 << 8) | G_gpg_vstate.io_le;
+            if (olen > GPG_MAX_CHALLENGE_LENGTH) {
+                return SWO_WRONG_LENGTH;
+            }
+            break;
         case PRIME_MODE:
             olen = G_gpg_vstate.io_le;
             break;
@@ -40,43 +187,34 @@ int gpg_apdu_get_challenge() {
         default:
             return SWO_WRONG_P1_P2;
     }
-    if (olen == 0 || olen > GPG_EXT_CHALLENGE_LENTH) {
+    if (olen == 0 ||
+        ((G_gpg_vstate.io_p1 != CHALLENGE_NOMINAL) && (olen > GPG_EXT_CHALLENGE_LENTH))) {
         return SWO_WRONG_LENGTH;
     }
 
     if (G_gpg_vstate.io_p1 == SEEDED_MODE) {
         // Ledger Add-on: Seeded random
-        unsigned int path[2];
-        unsigned char chain[32] = {0};
-
-        explicit_bzero(chain, 32);
-        path[0] = 0x80475047;
-        path[1] = 0x0F0F0F0F;
-        CX_CHECK(os_derive_bip32_no_throw(CX_CURVE_SECP256K1, path, 2, Sr, chain));
-        chain[0] = 'r';
-        chain[1] = 'n';
-        chain[2] = 'd';
-
-        cx_sha256_init(&G_gpg_vstate.work.md.sha256);
-        CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256, 0, Sr, 32, NULL, 0));
-        CX_CHECK(
-            cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256, 0, chain, 3, NULL, 0));
-        CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256,
+        // the seed stays in the I/O buffer until the output is produced
+        CX_CHECK(gpg_drbg_seeded_init());
+        H = gpg_io_scratch_alloc(CX_SHA256_SIZE);
+        sha256 = gpg_io_scratch_alloc(MAX(sizeof(cx_sha3_t), sizeof(cx_sha256_t)));
+        sha3 = (cx_sha3_t *) sha256;
+        memmove(sha256, &G_gpg_vstate.drbg.seeded, sizeof(cx_sha256_t));
+        CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha256,
                                   CX_LAST,
                                   G_gpg_vstate.work.io_buffer,
                                   G_gpg_vstate.io_length,
-                                  G_gpg_vstate.work.io_buffer,
-                                  32));
-        CX_CHECK(cx_sha3_xof_init_no_throw(&G_gpg_vstate.work.md.sha3, 256, olen));
-        CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha3,
+                                  H,
+                                  CX_SHA256_SIZE));
+        CX_CHECK(cx_sha3_xof_init_no_throw(sha3, 256, olen));
+        CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha3,
                                   CX_LAST,
-                                  G_gpg_vstate.work.io_buffer,
-                                  32,
+                                  H,
+                                  CX_SHA256_SIZE,
                                   G_gpg_vstate.work.io_buffer,
                                   olen));
     } else {
-        cx_rng(G_gpg_vstate.work.io_buffer, olen);
-        error = CX_OK;
+        CX_CHECK(gpg_drbg_generate(G_gpg_vstate.work.io_buffer, olen));
     }
 
     if (G_gpg_vstate.io_p1 == PRIME_MODE) {
@@ -85,7 +223,7 @@ int gpg_apdu_get_challenge() {
     }
 
 end:
-    explicit_bzero(&Sr, sizeof(Sr));
+    gpg_io_scratch_release(mark);
     if (error != CX_OK) {
         return error;
     }
@@ -19,6 +19,8 @@
 #include "gpg_ux.h"
 #include "cx_errors.h"
 
+static int gpg_archive_backup_start(void);
+
 /**
  * Select a DO (Data Object) in the current template
  *
@@ -32,6 +34,21 @@ void gpg_apdu_select_data(unsigned int ref, int record) {
     G_gpg_vstate.DO_offset = 0;
 }
 
+/**
+ * Insert the value of an NVM heap object, nothing if not set
+ * The value is sent from NVM, without being copied in the io buffer
+ *
+ * @param[in] handle object handle
+ *
+ */
+static void gpg_data_insert_heap(unsigned int handle) {
+    const unsigned char *value;
+    unsigned int len;
+
+    len = gpg_heap_get(handle, &value);
+    gpg_io_insert_nvm(value, len);
+}
+
 /**
  * Read a DO (Data Object) from the card
  *
@@ -54,20 +71,10 @@ int gpg_apdu_get_data(unsigned int ref) {
     switch (ref) {
             /* ----------------- Optional DO for private use ----------------- */
         case 0x0101:
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->private_DO1.value,
-                          N_gpg_pstate->private_DO1.length);
-            break;
         case 0x0102:
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->private_DO2.value,
-                          N_gpg_pstate->private_DO2.length);
-            break;
         case 0x0103:
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->private_DO3.value,
-                          N_gpg_pstate->private_DO3.length);
-            break;
         case 0x0104:
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->private_DO4.value,
-                          N_gpg_pstate->private_DO4.length);
+            gpg_data_insert_heap(HEAP_HANDLE(ref, HEAP_GLOBAL, 0));
             break;
 
             /* ----------------- Config key slot ----------------- */
@@ -85,6 +92,20 @@ int gpg_apdu_get_data(unsigned int ref) {
         case 0x01F8:
             gpg_io_insert((const unsigned char *) N_gpg_pstate->default_RSA_exponent, 4);
             break;
+            /* ----------------- Device archive ----------------- */
+        case 0x01FA:
+            sw = gpg_archive_backup_start();
+            break;
+            /* ----------------- ECDH cache ----------------- */
+        case 0x01FB:
+            gpg_io_insert_u8(G_gpg_vstate.ecdh_cache.size);
+            gpg_io_insert_u32(G_gpg_vstate.ecdh_cache.hits);
+            gpg_io_insert_u32(G_gpg_vstate.ecdh_cache.misses);
+            break;
+            /* ----------------- Card state counter ----------------- */
+        case 0x01FD:
+            gpg_io_insert_u32(N_gpg_pstate->state_counter);
+            break;
 
             /* ----------------- Application ----------------- */
         case 0x004F:
@@ -105,13 +126,11 @@ int gpg_apdu_get_data(unsigned int ref) {
             /* ----------------- User -----------------*/
         case 0x005E:
             /* Login data */
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->login.value,
-                          N_gpg_pstate->login.length);
+            gpg_data_insert_heap(HEAP_HANDLE(ref, HEAP_GLOBAL, 0));
             break;
         case 0x5F50:
             /* Uniform resource locator */
-            gpg_io_insert((const unsigned char *) N_gpg_pstate->keys[G_gpg_vstate.slot].url.value,
-                          N_gpg_pstate->keys[G_gpg_vstate.slot].url.length);
+            gpg_data_insert_heap(HEAP_HANDLE(ref, G_gpg_vstate.slot, 0));
             break;
         case 0x65:
             /* Name, Language, salutation */
@@ -190,16 +209,13 @@ int gpg_apdu_get_data(unsigned int ref) {
         case 0x7F21:
             switch (G_gpg_vstate.DO_reccord) {
                 case 0:
-                    gpg_io_insert(G_gpg_vstate.kslot->aut.CA.value,
-                                  G_gpg_vstate.kslot->aut.CA.length);
+                    gpg_data_insert_heap(HEAP_HANDLE(ref, G_gpg_vstate.slot, 0xC3));
                     break;
                 case 1:
-                    gpg_io_insert(G_gpg_vstate.kslot->dec.CA.value,
-                                  G_gpg_vstate.kslot->dec.CA.length);
+                    gpg_data_insert_heap(HEAP_HANDLE(ref, G_gpg_vstate.slot, 0xC2));
                     break;
                 case 2:
-                    gpg_io_insert(G_gpg_vstate.kslot->sig.CA.value,
-                                  G_gpg_vstate.kslot->sig.CA.length);
+                    gpg_data_insert_heap(HEAP_HANDLE(ref, G_gpg_vstate.slot, 0xC1));
                     break;
                 default:
                     sw = SWO_FILE_NOT_FOUND;
@@ -220,33 +236,1361 @@ int gpg_apdu_get_data(unsigned int ref) {
             break;
 
         default:
-            /* WAT */
-            sw = SWO_REFERENCED_DATA_NOT_FOUND;
-            break;
+            /* WAT */
+            sw = SWO_REFERENCED_DATA_NOT_FOUND;
+            break;
+    }
+
+    return sw;
+}
+
+/**
+ * Read the next instance of the same DO (Data Object) from the card
+ *
+ * @param[in] ref DO tag
+ *
+ * @return Status Word
+ *
+ */
+int gpg_apdu_get_next_data(unsigned int ref) {
+    int sw = SWO_UNKNOWN;
+
+    if ((ref != 0x7F21) || (G_gpg_vstate.DO_current != 0x7F21)) {
+        return SWO_CONDITIONS_NOT_SATISFIED;
+    }
+    sw = gpg_apdu_get_data(ref);
+    if (sw == SWO_SUCCESS) {
+        G_gpg_vstate.DO_reccord++;
+    }
+    return sw;
+}
+
+/**
+ * Read a slice of a DO (Data Object) from the card
+ * The slice starts at the offset given by an offset DO (54), or where the
+ * previous slice of the same DO ended. Its length is Le, 0 for up to the end
+ *
+ * @param[in] ref DO tag
+ *
+ * @return Status Word
+ *
+ */
+int gpg_apdu_get_data_slice(unsigned int ref) {
+    unsigned int t, l, off, len, total;
+    int sw = SWO_UNKNOWN;
+
+    if (G_gpg_vstate.io_lc != 0) {
+        gpg_io_fetch_tl(&t, &l);
+        if ((t != 0x54) || (l == 0) || (l > 2) || (G_gpg_vstate.io_lc != 2 + l)) {
+            return SWO_INCORRECT_DATA;
+        }
+        off = (l == 1) ? gpg_io_fetch_u8() : gpg_io_fetch_u16();
+    } else if (G_gpg_vstate.DO_current == ref) {
+        off = G_gpg_vstate.DO_offset;
+    } else {
+        off = 0;
+    }
+    len = G_gpg_vstate.io_le;
+
+    sw = gpg_apdu_get_data(ref);
+    if (sw != SWO_SUCCESS) {
+        return sw;
+    }
+    // streamed DOs (archive) are produced on the fly: no slice of them
+    if (G_gpg_vstate.io_stream_out) {
+        G_gpg_vstate.io_stream_out = 0;
+        gpg_data_stream_end();
+        gpg_io_discard(1);
+        return SWO_CONDITIONS_NOT_SATISFIED;
+    }
+    total = G_gpg_vstate.io_length + G_gpg_vstate.io_nvm_length;
+    if (off > total) {
+        gpg_io_discard(1);
+        return SWO_WRONG_P1_P2;
+    }
+    if ((len == 0) || (len > total - off)) {
+        len = total - off;
+    }
+    gpg_io_slice(off, len);
+    G_gpg_vstate.DO_offset = off + len;
+    return SWO_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------- */
+/* Extended Header list streamed import                                    */
+/* ----------------------------------------------------------------------- */
+
+/* 7F48 components (91..99) received and staged */
+#define IMPORT_ITEM(tag)  (1 << ((tag) - 0x91))
+#define IMPORT_RSA_ITEMS  (IMPORT_ITEM(0x91) | IMPORT_ITEM(0x92) | IMPORT_ITEM(0x93))
+
+/* Ledger add-on: import options, a vendor DO inside the CRT */
+#define IMPORT_OPTIONS_TAG  0xDF01
+#define IMPORT_CHECK_PUBLIC 0x01
+
+/**
+ * Abort the current key import
+ *
+ * @param[in] sw Status Word to report when the command completes
+ *
+ * @return -1
+ *
+ */
+static int gpg_import_fail(int sw) {
+    G_gpg_vstate.import.step = IMPORT_ERROR;
+    G_gpg_vstate.import.sw = sw;
+    return -1;
+}
+
+/**
+ * Read a TAG/LENGTH from the import header buffer
+ *
+ * @param[in] len number of bytes available
+ * @param[in,out] off current offset, updated on success
+ * @param[out] T read tag
+ * @param[out] L read length
+ *
+ * @return 1 if read, 0 if more bytes are needed, -1 if malformed
+ *
+ */
+static int gpg_import_fetch_tl(unsigned int len,
+                               unsigned int *off,
+                               unsigned int *T,
+                               unsigned int *L) {
+    const unsigned char *hdr = G_gpg_vstate.import.header;
+    unsigned int o = *off;
+
+    if (o >= len) {
+        return 0;
+    }
+    *T = hdr[o++];
+    if ((*T & 0x1F) == 0x1F) {
+        if (o >= len) {
+            return 0;
+        }
+        *T = (*T << 8) | hdr[o++];
+    }
+    if (o >= len) {
+        return 0;
+    }
+    *L = hdr[o++];
+    if (*L & 0x80) {
+        switch (*L & 0x7F) {
+            case 1:
+                if (o + 1 > len) {
+                    return 0;
+                }
+                *L = hdr[o];
+                o += 1;
+                break;
+            case 2:
+                if (o + 2 > len) {
+                    return 0;
+                }
+                *L = U2BE(hdr, o);
+                o += 2;
+                break;
+            default:
+                return -1;
+        }
+    }
+    *off = o;
+    return 1;
+}
+
+/**
+ * Parse the 4D / CRT / 7F48 / 5F48 headers gathered so far
+ *
+ * @return header length when complete, 0 if more bytes are needed, -1 on error
+ *
+ */
+static int gpg_import_parse_header(void) {
+    unsigned int len = G_gpg_vstate.import.hdr_length;
+    unsigned int off = 0;
+    unsigned int t, l, endof, total;
+    unsigned int options = 0;
+    int rc;
+
+    // fetch 4D
+    rc = gpg_import_fetch_tl(len, &off, &t, &l);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (t != 0x4D) {
+        return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+    }
+    // fetch B8/B6/A4
+    rc = gpg_import_fetch_tl(len, &off, &t, &l);
+    if (rc <= 0) {
+        return rc;
+    }
+    switch (t) {
+        case KEY_SIG:
+            G_gpg_vstate.import.keygpg = &G_gpg_vstate.kslot->sig;
+            break;
+        case KEY_AUT:
+            G_gpg_vstate.import.keygpg = &G_gpg_vstate.kslot->aut;
+            break;
+        case KEY_DEC:
+            G_gpg_vstate.import.keygpg = &G_gpg_vstate.kslot->dec;
+            break;
+        default:
+            return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+    }
+    if ((off + l) > len) {
+        return 0;
+    }
+    // CRT content: optional key reference (84), Ledger add-on import options
+    endof = off + l;
+    while (off < endof) {
+        if (gpg_import_fetch_tl(endof, &off, &t, &l) <= 0) {
+            return gpg_import_fail(SWO_INCORRECT_DATA);
+        }
+        if ((off + l) > endof) {
+            return gpg_import_fail(SWO_INCORRECT_DATA);
+        }
+        switch (t) {
+            case 0x84:
+                break;
+            case IMPORT_OPTIONS_TAG:
+                if (l != 1) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                options = G_gpg_vstate.import.header[off];
+                break;
+            default:
+                return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+        }
+        off += l;
+    }
+    G_gpg_vstate.import.options = options;
+    // fetch 7F48
+    rc = gpg_import_fetch_tl(len, &off, &t, &l);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (t != 0x7F48) {
+        return gpg_import_fail(SWO_INCORRECT_DATA);
+    }
+    if ((off + l) > len) {
+        return 0;
+    }
+    endof = off + l;
+    total = 0;
+    G_gpg_vstate.import.nb_items = 0;
+    while (off < endof) {
+        if (gpg_import_fetch_tl(endof, &off, &t, &l) <= 0) {
+            return gpg_import_fail(SWO_INCORRECT_DATA);
+        }
+        switch (t) {
+            case 0x91:
+            case 0x92:
+            case 0x93:
+            case 0x94:
+            case 0x95:
+            case 0x96:
+            case 0x97:
+            case 0x99:
+                break;
+            default:
+                return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+        }
+        if (G_gpg_vstate.import.nb_items == GPG_IMPORT_MAX_ITEMS) {
+            return gpg_import_fail(SWO_INCORRECT_DATA);
+        }
+        G_gpg_vstate.import.tags[G_gpg_vstate.import.nb_items] = t;
+        G_gpg_vstate.import.lengths[G_gpg_vstate.import.nb_items] = l;
+        G_gpg_vstate.import.nb_items++;
+        total += l;
+    }
+    // fetch 5F48
+    rc = gpg_import_fetch_tl(len, &off, &t, &l);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (t != 0x5F48) {
+        return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+    }
+    if (l != total) {
+        return gpg_import_fail(SWO_INCORRECT_DATA);
+    }
+    return off;
+}
+
+/**
+ * Prepare the work area to receive the key components
+ * announced by the 7F48 template
+ *
+ * @return 0 on success, -1 on error
+ *
+ */
+static int gpg_import_prepare(void) {
+    gpg_key_t *keygpg = G_gpg_vstate.import.keygpg;
+    unsigned int ksz, curve;
+
+    gpg_io_discard(1);
+    switch (keygpg->attributes.value[0]) {
+        case KEY_ID_RSA:
+            ksz = U2BE(keygpg->attributes.value, 1);
+            if ((ksz != 2048) && (ksz != 3072) && (ksz != 4096)) {
+                return gpg_import_fail(SWO_INCORRECT_DATA);
+            }
+            // p and q are stored on half modulus size
+            G_gpg_vstate.import.ksz = ksz >> 4;
+            break;
+        case KEY_ID_ECDH:
+        case KEY_ID_ECDSA:
+        case KEY_ID_EDDSA:
+            curve = gpg_oid2curve(&keygpg->attributes.value[1], keygpg->attributes.length - 1);
+            if (curve == CX_CURVE_NONE) {
+                return gpg_import_fail(SWO_INCORRECT_DATA);
+            }
+            G_gpg_vstate.import.ksz = gpg_curve2domainlen(curve);
+            G_gpg_vstate.work.ecfp.private.curve = curve;
+            G_gpg_vstate.work.ecfp.private.d_len = G_gpg_vstate.import.ksz;
+            break;
+        default:
+            return gpg_import_fail(SWO_REFERENCED_DATA_NOT_FOUND);
+    }
+    G_gpg_vstate.import.item = 0;
+    G_gpg_vstate.import.item_offset = 0;
+    G_gpg_vstate.import.step = IMPORT_DATA;
+    return 0;
+}
+
+/**
+ * Get the staging location of a key component
+ * Components not needed to rebuild the key are dropped
+ *
+ * @param[in] tag component tag from the 7F48 template
+ * @param[in] len component length
+ * @param[out] target where to write the component, NULL to drop it
+ *
+ * @return 0 on success, -1 on error
+ *
+ */
+static int gpg_import_target(unsigned int tag, unsigned int len, unsigned char **target) {
+    unsigned int ksz = G_gpg_vstate.import.ksz;
+    unsigned char *pq = G_gpg_vstate.work.rsa.public4096.n;
+
+    *target = NULL;
+    if (G_gpg_vstate.import.keygpg->attributes.value[0] == KEY_ID_RSA) {
+        switch (tag) {
+            case 0x91:
+                if (len > sizeof(G_gpg_vstate.import.e)) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = G_gpg_vstate.import.e + sizeof(G_gpg_vstate.import.e) - len;
+                break;
+            // p,q are put over pub key, this only work because adr<rsa_pub> < adr<p>
+            case 0x92:
+                if (len > ksz) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = pq + ksz - len;
+                break;
+            case 0x93:
+                if (len > ksz) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = pq + 2 * ksz - len;
+                break;
+            // modulus is put at its place in the private key
+            case 0x97:
+                if (len > 2 * ksz) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = G_gpg_vstate.work.rsa.private4096.d + 4 * ksz - len;
+                break;
+            // 1/q mod p, dp and dq are implied by (d, n)
+            default:
+                break;
+        }
+    } else {
+        switch (tag) {
+            case 0x92:
+                if (len != ksz) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = G_gpg_vstate.work.ecfp.private.d;
+                break;
+            // only uncompressed points are taken, 25519 keys are always derived
+            case 0x99:
+                if ((G_gpg_vstate.work.ecfp.private.curve == CX_CURVE_Ed25519) ||
+                    (G_gpg_vstate.work.ecfp.private.curve == CX_CURVE_Curve25519)) {
+                    break;
+                }
+                if (len != (2 * ksz + 1)) {
+                    return gpg_import_fail(SWO_INCORRECT_DATA);
+                }
+                *target = G_gpg_vstate.work.ecfp.public.W;
+                break;
+            default:
+                break;
+        }
+    }
+    if (*target != NULL) {
+        G_gpg_vstate.import.items |= IMPORT_ITEM(tag);
+    }
+    return 0;
+}
+
+/**
+ * Stage key components data
+ * Data beyond the components announced by the 7F48 template is an error
+ *
+ * @param[in] data components data
+ * @param[in] len data length
+ *
+ */
+static void gpg_import_data(const unsigned char *data, unsigned int len) {
+    unsigned int n, item;
+
+    while (G_gpg_vstate.import.step == IMPORT_DATA) {
+        item = G_gpg_vstate.import.item;
+        if (item == G_gpg_vstate.import.nb_items) {
+            G_gpg_vstate.import.step = IMPORT_DONE;
+            break;
+        }
+        if (G_gpg_vstate.import.item_offset == G_gpg_vstate.import.lengths[item]) {
+            // current component complete (or empty)
+            G_gpg_vstate.import.item++;
+            G_gpg_vstate.import.item_offset = 0;
+            continue;
+        }
+        if (len == 0) {
+            break;
+        }
+        if ((G_gpg_vstate.import.item_offset == 0) &&
+            (gpg_import_target(G_gpg_vstate.import.tags[item],
+                               G_gpg_vstate.import.lengths[item],
+                               &G_gpg_vstate.import.target) < 0)) {
+            break;
+        }
+        n = G_gpg_vstate.import.lengths[item] - G_gpg_vstate.import.item_offset;
+        if (n > len) {
+            n = len;
+        }
+        if (G_gpg_vstate.import.target != NULL) {
+            memmove(G_gpg_vstate.import.target + G_gpg_vstate.import.item_offset, data, n);
+        }
+        G_gpg_vstate.import.item_offset += n;
+        data += n;
+        len -= n;
+    }
+    // nothing may follow the announced components
+    if ((G_gpg_vstate.import.step == IMPORT_DONE) && (len != 0)) {
+        gpg_import_fail(SWO_WRONG_LENGTH);
+    }
+}
+
+/**
+ * Consume a chunk of an Extended Header list
+ *
+ * @param[in] chunk received data
+ * @param[in] len chunk length
+ *
+ */
+static void gpg_import_chunk(const unsigned char *chunk, unsigned int len) {
+    unsigned int n;
+    int hlen;
+
+    while ((len != 0) && (G_gpg_vstate.import.step == IMPORT_HEADER)) {
+        n = GPG_IMPORT_HEADER_LENGTH - G_gpg_vstate.import.hdr_length;
+        if (n > len) {
+            n = len;
+        }
+        memmove(G_gpg_vstate.import.header + G_gpg_vstate.import.hdr_length, chunk, n);
+        G_gpg_vstate.import.hdr_length += n;
+        chunk += n;
+        len -= n;
+        hlen = gpg_import_parse_header();
+        if (hlen < 0) {
+            return;
+        }
+        if (hlen == 0) {
+            if (G_gpg_vstate.import.hdr_length == GPG_IMPORT_HEADER_LENGTH) {
+                gpg_import_fail(SWO_WRONG_LENGTH);
+            }
+            continue;
+        }
+        if (gpg_import_prepare() < 0) {
+            return;
+        }
+        // bytes gathered beyond the headers are the first components bytes
+        gpg_import_data(G_gpg_vstate.import.header + hlen,
+                        G_gpg_vstate.import.hdr_length - hlen);
+    }
+    gpg_import_data(chunk, len);
+}
+
+/**
+ * Build the RSA private key from the staged p, q and n
+ *
+ * The private key only holds (d, n): instead of running the whole
+ * key pair generation, n is checked against p*q and d is computed
+ * as e^-1 mod (p-1)(q-1).
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_import_rsa_crt(void) {
+    unsigned int ksz = G_gpg_vstate.import.ksz;
+    unsigned char *p = G_gpg_vstate.work.rsa.public4096.n;
+    unsigned char *q = p + ksz;
+    unsigned char *d = G_gpg_vstate.work.rsa.private4096.d;
+    unsigned char *n = d + 2 * ksz;
+    cx_err_t error = CX_INTERNAL_ERROR;
+    int diff = 0;
+
+    // n == p*q
+    CX_CHECK(cx_math_mult_no_throw(d, p, q, ksz));
+    CX_CHECK(cx_math_cmp_no_throw(d, n, 2 * ksz, &diff));
+    if ((diff != 0) || ((p[ksz - 1] & 1) == 0) || ((q[ksz - 1] & 1) == 0)) {
+        return SWO_INCORRECT_DATA;
+    }
+
+    // phi = (p-1)(q-1), p and q being odd
+    p[ksz - 1] ^= 1;
+    q[ksz - 1] ^= 1;
+    CX_CHECK(cx_math_mult_no_throw(d, p, q, ksz));
+
+    // d = e^-1 mod phi, computed over p|q which are no more needed
+    CX_CHECK(cx_math_invintm_no_throw(p, U4BE(G_gpg_vstate.import.e, 0), d, 2 * ksz));
+    memmove(d, p, 2 * ksz);
+    G_gpg_vstate.work.rsa.private.size = 2 * ksz;
+
+end:
+    if (error != CX_OK) {
+        return error;
+    }
+    return SWO_SUCCESS;
+}
+
+/**
+ * Check the staged ECC public point
+ *
+ * The point must be on the curve. The full d.G comparison is only done
+ * when requested through the IMPORT_CHECK_PUBLIC option.
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_import_ecc_point(void) {
+    cx_ecfp_public_key_t *pub = &G_gpg_vstate.work.ecfp.public;
+    cx_curve_t curve = G_gpg_vstate.work.ecfp.private.curve;
+    unsigned int ksz = G_gpg_vstate.import.ksz;
+    cx_ecfp_640_public_key_t derived;
+    cx_ecpoint_t point;
+    bool on_curve = false;
+    bool locked = false;
+    cx_err_t error = CX_INTERNAL_ERROR;
+    int sw = SWO_INCORRECT_DATA;
+
+    if (pub->W[0] != 0x04) {
+        return SWO_INCORRECT_DATA;
+    }
+    pub->curve = curve;
+    pub->W_len = 2 * ksz + 1;
+
+    CX_CHECK(cx_bn_lock(ksz, 0));
+    locked = true;
+    CX_CHECK(cx_ecpoint_alloc(&point, curve));
+    CX_CHECK(cx_ecpoint_init(&point, pub->W + 1, ksz, pub->W + 1 + ksz, ksz));
+    CX_CHECK(cx_ecpoint_is_on_curve(&point, &on_curve));
+    CX_CHECK(cx_bn_unlock());
+    locked = false;
+    if (!on_curve) {
+        goto end;
+    }
+
+    if (G_gpg_vstate.import.options & IMPORT_CHECK_PUBLIC) {
+        CX_CHECK(cx_ecfp_generate_pair_no_throw(curve,
+                                                (cx_ecfp_public_key_t *) &derived,
+                                                &G_gpg_vstate.work.ecfp.private,
+                                                1));
+        if ((derived.W_len != pub->W_len) || (memcmp(derived.W, pub->W, pub->W_len) != 0)) {
+            goto end;
+        }
+    }
+    sw = SWO_SUCCESS;
+
+end:
+    if (locked) {
+        cx_bn_unlock();
+    }
+    if (error != CX_OK) {
+        return error;
+    }
+    return sw;
+}
+
+/**
+ * Build and write the imported key from the staged components
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_import_commit(void) {
+    gpg_key_t *keygpg = G_gpg_vstate.import.keygpg;
+    unsigned int ksz = G_gpg_vstate.import.ksz;
+    unsigned int pkey_size = 0;
+    unsigned int reset_cnt = 0;
+    cx_err_t error = CX_INTERNAL_ERROR;
+    int sw = SWO_UNKNOWN;
+
+    switch (G_gpg_vstate.import.step) {
+        case IMPORT_DONE:
+            break;
+        case IMPORT_ERROR:
+            sw = G_gpg_vstate.import.sw;
+            goto out;
+        default:
+            sw = SWO_WRONG_LENGTH;
+            goto out;
+    }
+
+    if (keygpg->attributes.value[0] == KEY_ID_RSA) {
+        cx_rsa_public_key_t *rsa_pub;
+        cx_rsa_private_key_t *rsa_priv;
+
+        switch (ksz << 1) {
+            case 2048 / 8:
+                pkey_size = sizeof(cx_rsa_2048_private_key_t);
+                break;
+            case 3072 / 8:
+                pkey_size = sizeof(cx_rsa_3072_private_key_t);
+                break;
+            case 4096 / 8:
+                pkey_size = sizeof(cx_rsa_4096_private_key_t);
+                break;
+            default:
+                break;
+        }
+        if ((pkey_size == 0) || (U4BE(G_gpg_vstate.import.e, 0) == 0) ||
+            ((G_gpg_vstate.import.items & IMPORT_RSA_ITEMS) != IMPORT_RSA_ITEMS)) {
+            sw = SWO_INCORRECT_DATA;
+            goto out;
+        }
+        rsa_pub = (cx_rsa_public_key_t *) &G_gpg_vstate.work.rsa.public;
+        rsa_priv = (cx_rsa_private_key_t *) &G_gpg_vstate.work.rsa.private;
+
+        if (G_gpg_vstate.import.items & IMPORT_ITEM(0x97)) {
+            // modulus provided: check it and only compute d
+            sw = gpg_import_rsa_crt();
+            if (sw != SWO_SUCCESS) {
+                goto out;
+            }
+        } else {
+            // regenerate RSA private key
+            CX_CHECK(cx_rsa_generate_pair_no_throw(ksz << 1,
+                                                   rsa_pub,
+                                                   rsa_priv,
+                                                   G_gpg_vstate.import.e,
+                                                   sizeof(G_gpg_vstate.import.e),
+                                                   G_gpg_vstate.work.rsa.public4096.n));
+        }
+
+        // write keys
+        gpg_gen_pub_invalidate(keygpg);
+        nvm_write(&keygpg->pub_key.rsa, G_gpg_vstate.import.e, 4);
+        nvm_write(&keygpg->priv_key.rsa, rsa_priv, pkey_size);
+    } else {
+        if ((G_gpg_vstate.import.items & IMPORT_ITEM(0x92)) == 0) {
+            sw = SWO_INCORRECT_DATA;
+            goto out;
+        }
+        if (G_gpg_vstate.import.items & IMPORT_ITEM(0x99)) {
+            sw = gpg_import_ecc_point();
+            if (sw != SWO_SUCCESS) {
+                goto out;
+            }
+        } else {
+            CX_CHECK(cx_ecfp_generate_pair_no_throw(G_gpg_vstate.work.ecfp.private.curve,
+                                                    &G_gpg_vstate.work.ecfp.public,
+                                                    &G_gpg_vstate.work.ecfp.private,
+                                                    1));
+        }
+        gpg_gen_pub_invalidate(keygpg);
+        nvm_write(&keygpg->pub_key.ecfp,
+                  &G_gpg_vstate.work.ecfp.public,
+                  sizeof(cx_ecfp_public_key_t));
+        nvm_write(&keygpg->priv_key.ecfp,
+                  &G_gpg_vstate.work.ecfp.private,
+                  sizeof(cx_ecfp_private_key_t));
+    }
+    if (keygpg == &G_gpg_vstate.kslot->sig) {
+        nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
+    }
+    sw = SWO_SUCCESS;
+
+end:
+    if (error != CX_OK) {
+        sw = error;
+    }
+out:
+    explicit_bzero(&G_gpg_vstate.import, sizeof(G_gpg_vstate.import));
+    return sw;
+}
+
+/* ----------------------------------------------------------------------- */
+/* ---                        Device archive                          --- */
+/* ----------------------------------------------------------------------- */
+
+#define ARCHIVE_REC_DATA 0x01
+#define ARCHIVE_REC_ZERO 0x02
+#define ARCHIVE_REC_END  0xFF
+
+// record plaintext: seq(2) | type(1) | offset(4) | length(2) | data
+#define ARCHIVE_REC_HEADER_LENGTH 9
+// zero runs shorter than this are kept in DATA records
+#define ARCHIVE_ZERO_RUN 16
+// decrypted records are placed after the received one
+#define ARCHIVE_PLAIN_OFFSET 512
+
+/**
+ * Abort the archive processing
+ *
+ * @param[in] sw Status Word returned when the command completes
+ *
+ */
+static void gpg_archive_fail(int sw) {
+    G_gpg_vstate.archive.step = ARCHIVE_ERROR;
+    G_gpg_vstate.archive.sw = sw;
+}
+
+/**
+ * Get an NVM region covered by the archive
+ * PINs and magic are never part of it
+ *
+ * @param[in] idx region index
+ * @param[out] offset region offset in the NVM state
+ *
+ * @return region length, 0 when no more region
+ *
+ */
+static unsigned int gpg_archive_region(unsigned int idx, unsigned int *offset) {
+    switch (idx) {
+        case 0:
+            // config, private DOs, cardholder, AID, histo, PW status
+            *offset = offsetof(gpg_nv_state_t, config_pin);
+            return offsetof(gpg_nv_state_t, PW1) - *offset;
+        case 1:
+            // key slots and SM keys
+            *offset = offsetof(gpg_nv_state_t, keys);
+            return sizeof(gpg_nv_state_t) - *offset;
+        default:
+            *offset = 0;
+            return 0;
+    }
+}
+
+/**
+ * Check a restored range is fully inside one archive region
+ *
+ * @param[in] offset range offset in the NVM state
+ * @param[in] len range length
+ *
+ * @return 1 if allowed, 0 otherwise
+ *
+ */
+static int gpg_archive_check_range(unsigned int offset, unsigned int len) {
+    unsigned int idx, roff, rlen;
+
+    for (idx = 0; (rlen = gpg_archive_region(idx, &roff)) != 0; idx++) {
+        if ((offset >= roff) && (len <= rlen) && (offset - roff <= rlen - len)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Derive the archive encryption and authentication keys
+ * Keys are derived from the slot 0 seed, so they are bound to the device seed
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_archive_init_keys(void) {
+    int sw = SWO_UNKNOWN;
+    // BIP32 output, the slot seed is its first 32 bytes
+    unsigned char seed[66];
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    sw = gpg_pso_derive_slot_seed(0, seed);
+    if (sw != SWO_SUCCESS) {
+        goto out;
+    }
+    sw = gpg_pso_derive_key_seed(seed,
+                                 (unsigned char *) PIC("arc "),
+                                 2,
+                                 G_gpg_vstate.archive.mac_key,
+                                 sizeof(G_gpg_vstate.archive.mac_key));
+    if (sw != SWO_SUCCESS) {
+        goto out;
+    }
+    sw = gpg_pso_derive_key_seed(seed, (unsigned char *) PIC("arc "), 1, seed, CX_AES_BLOCK_SIZE);
+    if (sw != SWO_SUCCESS) {
+        goto out;
+    }
+    CX_CHECK(cx_aes_init_key_no_throw(seed, CX_AES_BLOCK_SIZE, &G_gpg_vstate.archive.key));
+
+end:
+    if (error != CX_OK) {
+        sw = error;
+    }
+out:
+    explicit_bzero(seed, sizeof(seed));
+    return sw;
+}
+
+/**
+ * Compute the next chained authentication code
+ * HMAC-SHA256 over the previous code and the data: the clear header for the
+ * first one, then each record ciphertext. The result becomes the new chain.
+ *
+ * @param[in] data header or record ciphertext
+ * @param[in] len data length
+ * @param[out] mac computed HMAC-SHA256
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_archive_mac(const unsigned char *data, unsigned int len, unsigned char *mac) {
+    cx_hmac_sha256_t hmac;
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    CX_CHECK(cx_hmac_sha256_init_no_throw(&hmac,
+                                          G_gpg_vstate.archive.mac_key,
+                                          sizeof(G_gpg_vstate.archive.mac_key)));
+    CX_CHECK(cx_hmac_no_throw((cx_hmac_t *) &hmac,
+                              0,
+                              G_gpg_vstate.archive.chain,
+                              sizeof(G_gpg_vstate.archive.chain),
+                              NULL,
+                              0));
+    CX_CHECK(cx_hmac_no_throw((cx_hmac_t *) &hmac, CX_LAST, data, len, mac, CX_SHA256_SIZE));
+    memmove(G_gpg_vstate.archive.chain, mac, CX_SHA256_SIZE);
+
+end:
+    explicit_bzero(&hmac, sizeof(hmac));
+    return error;
+}
+
+/**
+ * Start the archive backup: derive keys and output the clear header
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_archive_backup_start(void) {
+    int sw = SWO_UNKNOWN;
+
+    explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+    sw = gpg_archive_init_keys();
+    if (sw != SWO_SUCCESS) {
+        explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+        return sw;
+    }
+    cx_rng(G_gpg_vstate.archive.iv, sizeof(G_gpg_vstate.archive.iv));
+
+    // key derivation used the work area
+    gpg_io_discard(1);
+    gpg_io_insert_u32(TARGET_ID);
+    gpg_io_insert_u8(GPG_ARCHIVE_VERSION);
+    gpg_io_insert_u32(sizeof(gpg_nv_state_t));
+    gpg_io_insert(G_gpg_vstate.archive.iv, sizeof(G_gpg_vstate.archive.iv));
+    sw = gpg_archive_mac(G_gpg_vstate.work.io_buffer,
+                         GPG_ARCHIVE_HEADER_LENGTH,
+                         G_gpg_vstate.archive.chain);
+    if (sw != CX_OK) {
+        explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+        return sw;
+    }
+
+    G_gpg_vstate.archive.step = ARCHIVE_RECORDS;
+    G_gpg_vstate.io_stream_out = 1;
+    return SWO_SUCCESS;
+}
+
+/**
+ * Output the next archive record at the end of the response
+ *
+ * @return SWO_RESPONSE_BYTES_AVAILABLE if more records follow,
+ *         SWO_SUCCESS after the last one, or an error Status Word
+ *
+ */
+static int gpg_archive_backup_next(void) {
+    const unsigned char *nv = (const unsigned char *) N_gpg_pstate;
+    unsigned char *rec, *pt;
+    unsigned int roff, rlen, off, n, len, type, pt_len;
+    size_t ct_len;
+    cx_err_t error = CX_INTERNAL_ERROR;
+    int sw = SWO_UNKNOWN;
+
+    if (G_gpg_vstate.archive.step != ARCHIVE_RECORDS) {
+        sw = SWO_CONDITIONS_NOT_SATISFIED;
+        goto out;
+    }
+    if (G_gpg_vstate.io_length + GPG_ARCHIVE_RECORD_LENGTH > GPG_IO_BUFFER_LENGTH) {
+        sw = SWO_UNKNOWN;
+        goto out;
+    }
+    rec = G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_length;
+    pt = rec + 2;
+
+    // skip exhausted regions
+    rlen = gpg_archive_region(G_gpg_vstate.archive.region, &roff);
+    while ((rlen != 0) && (G_gpg_vstate.archive.offset >= rlen)) {
+        G_gpg_vstate.archive.region++;
+        G_gpg_vstate.archive.offset = 0;
+        rlen = gpg_archive_region(G_gpg_vstate.archive.region, &roff);
+    }
+
+    if (rlen == 0) {
+        // END record carries the number of records in place of the offset
+        type = ARCHIVE_REC_END;
+        off = G_gpg_vstate.archive.seq;
+        len = 0;
+    } else {
+        off = roff + G_gpg_vstate.archive.offset;
+        n = rlen - G_gpg_vstate.archive.offset;
+        for (len = 0; (len < n) && (len < 0xFFFF) && (nv[off + len] == 0); len++) {
+        }
+        if ((len >= ARCHIVE_ZERO_RUN) || (len == n)) {
+            type = ARCHIVE_REC_ZERO;
+        } else {
+            type = ARCHIVE_REC_DATA;
+            len = MIN(n, GPG_ARCHIVE_FRAGMENT_LENGTH);
+        }
+        G_gpg_vstate.archive.offset += len;
+    }
+
+    U2BE_ENCODE(pt, 0, G_gpg_vstate.archive.seq);
+    pt[2] = type;
+    U4BE_ENCODE(pt, 3, off);
+    U2BE_ENCODE(pt, 7, len);
+    pt_len = ARCHIVE_REC_HEADER_LENGTH;
+    if (type == ARCHIVE_REC_DATA) {
+        memmove(pt + pt_len, nv + off, len);
+        pt_len += len;
+    }
+
+    // encrypt in place, CBC chained over the whole archive
+    ct_len = GPG_ARCHIVE_RECORD_LENGTH - 2 - CX_SHA256_SIZE;
+    CX_CHECK(cx_aes_iv_no_throw(&G_gpg_vstate.archive.key,
+                                CX_ENCRYPT | CX_CHAIN_CBC | CX_PAD_ISO9797M2 | CX_LAST,
+                                G_gpg_vstate.archive.iv,
+                                CX_AES_BLOCK_SIZE,
+                                pt,
+                                pt_len,
+                                pt,
+                                &ct_len));
+    memmove(G_gpg_vstate.archive.iv, pt + ct_len - CX_AES_BLOCK_SIZE, CX_AES_BLOCK_SIZE);
+    CX_CHECK(gpg_archive_mac(pt, ct_len, pt + ct_len));
+    U2BE_ENCODE(rec, 0, ct_len);
+    gpg_io_inserted(2 + ct_len + CX_SHA256_SIZE);
+    G_gpg_vstate.archive.seq++;
+
+    if (type != ARCHIVE_REC_END) {
+        return SWO_RESPONSE_BYTES_AVAILABLE;
+    }
+    sw = SWO_SUCCESS;
+
+end:
+    if (error != CX_OK) {
+        sw = error;
+    }
+out:
+    explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+    return sw;
+}
+
+/**
+ * Start the archive restore
+ *
+ */
+static void gpg_archive_restore_start(void) {
+    int sw;
+
+    explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+    if (!gpg_pin_is_verified(PIN_ID_PW3)) {
+        gpg_archive_fail(SWO_SECURITY_CONDITION_NOT_SATISFIED);
+        return;
+    }
+    sw = gpg_archive_init_keys();
+    if (sw != SWO_SUCCESS) {
+        gpg_archive_fail(sw);
+        return;
+    }
+    G_gpg_vstate.archive.step = ARCHIVE_HEADER;
+    G_gpg_vstate.archive.rec_length = GPG_ARCHIVE_HEADER_LENGTH;
+}
+
+/**
+ * Check the archive clear header gathered in the I/O buffer
+ *
+ */
+static void gpg_archive_restore_header(void) {
+    const unsigned char *hdr = G_gpg_vstate.work.io_buffer;
+    unsigned char mac[CX_SHA256_SIZE];
+
+    if ((U4BE(hdr, 0) != TARGET_ID) || (hdr[4] != GPG_ARCHIVE_VERSION) ||
+        (U4BE(hdr, 5) != sizeof(gpg_nv_state_t))) {
+        gpg_archive_fail(SWO_INCORRECT_DATA);
+        return;
+    }
+    // the header is authenticated by the first record code
+    if (gpg_archive_mac(hdr, GPG_ARCHIVE_HEADER_LENGTH, mac) != CX_OK) {
+        gpg_archive_fail(SWO_INCORRECT_DATA);
+        return;
+    }
+    memmove(G_gpg_vstate.archive.iv, hdr + 9, CX_AES_BLOCK_SIZE);
+    // the archive authenticated by the last check pass is applied, any other
+    // one is only checked
+    if (G_gpg_vstate.archive_checked.valid &&
+        (memcmp(G_gpg_vstate.archive_checked.iv, hdr + 9, CX_AES_BLOCK_SIZE) == 0)) {
+        G_gpg_vstate.archive.apply = 1;
+    } else {
+        G_gpg_vstate.archive_checked.valid = 0;
+        memmove(G_gpg_vstate.archive_checked.iv, hdr + 9, CX_AES_BLOCK_SIZE);
+    }
+    G_gpg_vstate.archive.step = ARCHIVE_RECORDS;
+}
+
+/**
+ * Write a restored range in NVM, during the write pass only
+ * The restore is flagged as pending before the first write
+ *
+ * @param[in] off range offset in the NVM state
+ * @param[in] value range value, NULL to zero it
+ * @param[in] len range length
+ *
+ */
+static void gpg_archive_restore_write(unsigned int off,
+                                      const unsigned char *value,
+                                      unsigned int len) {
+    unsigned int pending = 1;
+
+    if (!G_gpg_vstate.archive.apply) {
+        return;
+    }
+    if (!N_gpg_pstate->restore_pending) {
+        nvm_write((void *) &N_gpg_pstate->restore_pending, &pending, sizeof(unsigned int));
+    }
+    nvm_write((unsigned char *) N_gpg_pstate + off, (void *) value, len);
+}
+
+/**
+ * Authenticate, decrypt and apply the record gathered in the I/O buffer
+ *
+ */
+static void gpg_archive_restore_record(void) {
+    unsigned char *ct = G_gpg_vstate.work.io_buffer + 2;
+    unsigned char *pt = G_gpg_vstate.work.io_buffer + ARCHIVE_PLAIN_OFFSET;
+    unsigned int ct_len, off, len;
+    size_t pt_len;
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    ct_len = G_gpg_vstate.archive.rec_length - 2 - CX_SHA256_SIZE;
+    CX_CHECK(gpg_archive_mac(ct, ct_len, pt));
+    if (os_secure_memcmp(pt, ct + ct_len, CX_SHA256_SIZE) != 0) {
+        gpg_archive_fail(SWO_INCORRECT_DATA);
+        return;
+    }
+    pt_len = GPG_ARCHIVE_RECORD_LENGTH;
+    CX_CHECK(cx_aes_iv_no_throw(&G_gpg_vstate.archive.key,
+                                CX_DECRYPT | CX_CHAIN_CBC | CX_PAD_ISO9797M2 | CX_LAST,
+                                G_gpg_vstate.archive.iv,
+                                CX_AES_BLOCK_SIZE,
+                                ct,
+                                ct_len,
+                                pt,
+                                &pt_len));
+    memmove(G_gpg_vstate.archive.iv, ct + ct_len - CX_AES_BLOCK_SIZE, CX_AES_BLOCK_SIZE);
+
+    if ((pt_len < ARCHIVE_REC_HEADER_LENGTH) || (U2BE(pt, 0) != G_gpg_vstate.archive.seq)) {
+        gpg_archive_fail(SWO_INCORRECT_DATA);
+        return;
+    }
+    off = U4BE(pt, 3);
+    len = U2BE(pt, 7);
+    switch (pt[2]) {
+        case ARCHIVE_REC_DATA:
+            if ((pt_len != ARCHIVE_REC_HEADER_LENGTH + len) ||
+                !gpg_archive_check_range(off, len)) {
+                break;
+            }
+            gpg_archive_restore_write(off, pt + ARCHIVE_REC_HEADER_LENGTH, len);
+            G_gpg_vstate.archive.seq++;
+            return;
+        case ARCHIVE_REC_ZERO:
+            if ((pt_len != ARCHIVE_REC_HEADER_LENGTH) || !gpg_archive_check_range(off, len)) {
+                break;
+            }
+            gpg_archive_restore_write(off, NULL, len);
+            G_gpg_vstate.archive.seq++;
+            return;
+        case ARCHIVE_REC_END:
+            if ((pt_len != ARCHIVE_REC_HEADER_LENGTH) || (off != G_gpg_vstate.archive.seq)) {
+                break;
+            }
+            G_gpg_vstate.archive.step = ARCHIVE_DONE;
+            return;
+        default:
+            break;
+    }
+    gpg_archive_fail(SWO_INCORRECT_DATA);
+    return;
+
+end:
+    gpg_archive_fail(SWO_INCORRECT_DATA);
+}
+
+/**
+ * Consume a chunk of the archive being restored
+ * Header and records are gathered one at a time at the I/O buffer start
+ *
+ * @param[in] chunk received data
+ * @param[in] len chunk length
+ *
+ */
+static void gpg_archive_restore_chunk(const unsigned char *chunk, unsigned int len) {
+    unsigned int n, ct_len;
+
+    while ((len != 0) && ((G_gpg_vstate.archive.step == ARCHIVE_HEADER) ||
+                          (G_gpg_vstate.archive.step == ARCHIVE_RECORDS))) {
+        n = MIN(len, (unsigned int) (G_gpg_vstate.archive.rec_length -
+                                     G_gpg_vstate.archive.rec_offset));
+        memmove(G_gpg_vstate.work.io_buffer + G_gpg_vstate.archive.rec_offset, chunk, n);
+        G_gpg_vstate.archive.rec_offset += n;
+        chunk += n;
+        len -= n;
+        if (G_gpg_vstate.archive.rec_offset < G_gpg_vstate.archive.rec_length) {
+            continue;
+        }
+
+        if (G_gpg_vstate.archive.step == ARCHIVE_HEADER) {
+            gpg_archive_restore_header();
+        } else if (G_gpg_vstate.archive.rec_length == 2) {
+            // ciphertext length known, gather the whole record
+            ct_len = U2BE(G_gpg_vstate.work.io_buffer, 0);
+            if ((ct_len < CX_AES_BLOCK_SIZE) || (ct_len % CX_AES_BLOCK_SIZE) ||
+                (2 + ct_len + CX_SHA256_SIZE > GPG_ARCHIVE_RECORD_LENGTH)) {
+                gpg_archive_fail(SWO_INCORRECT_DATA);
+                break;
+            }
+            G_gpg_vstate.archive.rec_length = 2 + ct_len + CX_SHA256_SIZE;
+            continue;
+        } else {
+            gpg_archive_restore_record();
+        }
+        G_gpg_vstate.archive.rec_length = 2;
+        G_gpg_vstate.archive.rec_offset = 0;
+    }
+}
+
+/**
+ * Complete the archive restore pass, check or write
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_archive_restore_end(void) {
+    int sw;
+
+    unsigned int pending = 0;
+
+    switch (G_gpg_vstate.archive.step) {
+        case ARCHIVE_DONE:
+            if (!G_gpg_vstate.archive.apply) {
+                // check pass: the whole chain is authenticated, nothing written
+                G_gpg_vstate.archive_checked.valid = 1;
+                sw = SWO_SUCCESS;
+                break;
+            }
+            nvm_write((void *) &N_gpg_pstate->restore_pending, &pending, sizeof(unsigned int));
+            explicit_bzero(&G_gpg_vstate.archive_checked, sizeof(G_gpg_vstate.archive_checked));
+            gpg_state_counter_bump();
+            // restored keys and config are active now
+            gpg_mse_reset();
+            sw = SWO_SUCCESS;
+            break;
+        case ARCHIVE_ERROR:
+            sw = G_gpg_vstate.archive.sw;
+            break;
+        default:
+            sw = SWO_WRONG_LENGTH;
+            break;
+    }
+    // a write pass failing after its first write leaves the restore pending:
+    // the checked archive can be sent again, or the application is reset on
+    // its next start
+    explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
+    return sw;
+}
+
+/**
+ * Get the key attributes tag of the selected cardholder certificate
+ *
+ * @return C1, C2 or C3, 0 if the selected record does not exist
+ *
+ */
+static unsigned int gpg_data_cert_key(void) {
+    switch (G_gpg_vstate.DO_reccord) {
+        case 0:
+            return 0xC3;
+        case 1:
+            return 0xC1;
+        case 2:
+            return 0xC2;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Check if the current command data is consumed as a stream
+ * and init the corresponding state
+ *
+ * @return 1 if streamed, 0 if the data must be buffered
+ *
+ */
+int gpg_data_stream_start(void) {
+    if ((G_gpg_vstate.io_ins != INS_PUT_DATA) && (G_gpg_vstate.io_ins != INS_PUT_DATA_ODD)) {
+        return 0;
+    }
+    if (G_gpg_vstate.io_p1p2 == 0x01FA) {
+        gpg_io_taint();
+        gpg_archive_restore_start();
+        return 1;
+    }
+    if ((G_gpg_vstate.io_ins == INS_PUT_DATA) && (G_gpg_vstate.io_p1p2 == 0x7F21)) {
+        // certificates are larger than the io buffer
+        gpg_heap_stream_start(HEAP_HANDLE(0x7F21, G_gpg_vstate.slot, gpg_data_cert_key()),
+                              GPG_EXT_CARD_HOLDER_CERT_LENTH);
+        if (gpg_data_cert_key() == 0) {
+            G_gpg_vstate.heap_stream.sw = SWO_REFERENCED_DATA_NOT_FOUND;
+        } else if (!gpg_pin_is_verified(PIN_ID_PW3)) {
+            G_gpg_vstate.heap_stream.sw = SWO_SECURITY_CONDITION_NOT_SATISFIED;
+        }
+        return 1;
+    }
+    if (G_gpg_vstate.io_p1p2 != 0x3FFF) {
+        return 0;
+    }
+    // key components are gathered in the work area
+    gpg_io_taint();
+    explicit_bzero(&G_gpg_vstate.import, sizeof(G_gpg_vstate.import));
+    G_gpg_vstate.import.step = IMPORT_HEADER;
+    // never stage any key material without the access right
+    if (!gpg_pin_is_verified(PIN_ID_PW3)) {
+        gpg_import_fail(SWO_SECURITY_CONDITION_NOT_SATISFIED);
+    }
+    return 1;
+}
+
+/**
+ * Consume a chunk of a streamed command data
+ *
+ * @param[in] chunk received data
+ * @param[in] len chunk length
+ *
+ */
+void gpg_data_stream_chunk(const unsigned char *chunk, unsigned int len) {
+    switch (G_gpg_vstate.io_p1p2) {
+        case 0x3FFF:
+            gpg_import_chunk(chunk, len);
+            break;
+        case 0x01FA:
+            gpg_archive_restore_chunk(chunk, len);
+            break;
+        case 0x7F21:
+            gpg_heap_stream_chunk(chunk, len);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Produce the next part of a streamed response
+ *
+ * @return SWO_RESPONSE_BYTES_AVAILABLE if more data follows,
+ *         SWO_SUCCESS when complete, or an error Status Word
+ *
+ */
+int gpg_data_stream_next(void) {
+    if (G_gpg_vstate.io_ins == INS_PSO) {
+        return gpg_pso_batch_next();
+    }
+    switch (G_gpg_vstate.io_p1p2) {
+        case 0x01FA:
+            return gpg_archive_backup_next();
+        default:
+            return SWO_CONDITIONS_NOT_SATISFIED;
     }
+}
 
-    return sw;
+/**
+ * Abort a streamed response
+ *
+ */
+void gpg_data_stream_end(void) {
+    if (G_gpg_vstate.io_ins == INS_PSO) {
+        gpg_pso_batch_end();
+        return;
+    }
+    explicit_bzero(&G_gpg_vstate.archive, sizeof(G_gpg_vstate.archive));
 }
 
 /**
- * Read the next instance of the same DO (Data Object) from the card
+ * Check key algorithm attributes
  *
- * @param[in] ref DO tag
+ * @param[in] ref attributes DO tag (C1, C2, C3)
+ * @param[in] value attributes
+ * @param[in] len attributes length
  *
  * @return Status Word
  *
  */
-int gpg_apdu_get_next_data(unsigned int ref) {
-    int sw = SWO_UNKNOWN;
+static int gpg_data_check_attributes(unsigned int ref,
+                                     const unsigned char *value,
+                                     unsigned int len) {
+    unsigned int ksz, curve;
 
-    if ((ref != 0x7F21) || (G_gpg_vstate.DO_current != 0x7F21)) {
-        return SWO_CONDITIONS_NOT_SATISFIED;
+    if (len > 12) {
+        return SWO_WRONG_LENGTH;
     }
-    sw = gpg_apdu_get_data(ref);
-    if (sw == SWO_SUCCESS) {
-        G_gpg_vstate.DO_reccord++;
+    if (len == 0) {
+        return SWO_INCORRECT_DATA;
+    }
+    switch (value[0]) {
+        case KEY_ID_RSA:
+            ksz = U2BE(value, 1);
+            if ((ksz != 2048) && (ksz != 3072) && (ksz != 4096)) {
+                return SWO_INCORRECT_DATA;
+            }
+            return SWO_SUCCESS;
+        case KEY_ID_ECDH:
+        case KEY_ID_ECDSA:
+        case KEY_ID_EDDSA:
+            curve = gpg_oid2curve((unsigned char *) value + 1, len - 1);
+#ifdef NO_DECRYPT_cv25519
+            if ((ref == 0xC2) && (curve == CX_CURVE_Curve25519)) {
+                return SWO_INCORRECT_DATA;
+            }
+#else
+            UNUSED(ref);
+#endif
+            if (curve == CX_CURVE_NONE) {
+                return SWO_INCORRECT_DATA;
+            }
+            return SWO_SUCCESS;
+        default:
+            return SWO_INCORRECT_DATA;
     }
-    return sw;
 }
 
 /**
@@ -257,49 +1601,30 @@ int gpg_apdu_get_next_data(unsigned int ref) {
  * @return Status Word
  *
  */
-int gpg_apdu_put_data(unsigned int ref) {
-    unsigned int t, l, sw;
+static int gpg_data_put(unsigned int ref) {
+    unsigned int sw;
     unsigned int *ptr_l = NULL;
     unsigned char *ptr_v = NULL;
     void *pkey = NULL;
     cx_aes_key_t aes_key = {0};
     cx_err_t error = CX_INTERNAL_ERROR;
-    unsigned int pkey_size = 0;
-    unsigned int ksz, curve;
-#ifdef NO_DECRYPT_cv25519
-    bool decKey = false;
-#endif
+    unsigned int cert_key;
 
     G_gpg_vstate.DO_current = ref;
 
     switch (ref) {
             /*  ----------------- Optional DO for private use ----------------- */
         case 0x0101:
-            ptr_l = (unsigned int *) &N_gpg_pstate->private_DO1.length;
-            ptr_v = (unsigned char *) N_gpg_pstate->private_DO1.value;
-            goto WRITE_PRIVATE_DO;
         case 0x0102:
-            ptr_l = (unsigned int *) &N_gpg_pstate->private_DO2.length;
-            ptr_v = (unsigned char *) N_gpg_pstate->private_DO2.value;
-            goto WRITE_PRIVATE_DO;
         case 0x0103:
-            ptr_l = (unsigned int *) &N_gpg_pstate->private_DO3.length;
-            ptr_v = (unsigned char *) N_gpg_pstate->private_DO3.value;
-            goto WRITE_PRIVATE_DO;
         case 0x0104:
-            ptr_l = (unsigned int *) &N_gpg_pstate->private_DO4.length;
-            ptr_v = (unsigned char *) N_gpg_pstate->private_DO4.value;
-            goto WRITE_PRIVATE_DO;
-        WRITE_PRIVATE_DO:
             if (G_gpg_vstate.io_length > GPG_EXT_PRIVATE_DO_LENGTH) {
                 sw = SWO_WRONG_LENGTH;
                 break;
             }
-            nvm_write(ptr_v,
-                      G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                      G_gpg_vstate.io_length);
-            nvm_write(ptr_l, &G_gpg_vstate.io_length, sizeof(unsigned int));
-            sw = SWO_SUCCESS;
+            sw = gpg_heap_put(HEAP_HANDLE(ref, HEAP_GLOBAL, 0),
+                              G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
+                              G_gpg_vstate.io_length);
             break;
             /*  ----------------- Config key slot ----------------- */
         case 0x01F1:
@@ -330,7 +1655,7 @@ int gpg_apdu_put_data(unsigned int ref) {
                 break;
             }
             G_gpg_vstate.slot = G_gpg_vstate.work.io_buffer[G_gpg_vstate.io_offset];
-            G_gpg_vstate.kslot = (gpg_key_slot_t *) &N_gpg_pstate->keys[G_gpg_vstate.slot];
+            G_gpg_vstate.kslot = gpg_install_slot_get(G_gpg_vstate.slot);
             gpg_mse_reset();
             ui_CCID_reset();
             sw = SWO_SUCCESS;
@@ -349,6 +1674,17 @@ int gpg_apdu_put_data(unsigned int ref) {
             break;
         }
 
+        /* ----------------- ECDH cache ----------------- */
+        case 0x01FB:
+            if ((G_gpg_vstate.io_length != 1) ||
+                (G_gpg_vstate.work.io_buffer[G_gpg_vstate.io_offset] > GPG_ECDH_CACHE_ENTRIES)) {
+                sw = SWO_INCORRECT_DATA;
+                break;
+            }
+            gpg_pso_ecdh_cache_config(G_gpg_vstate.work.io_buffer[G_gpg_vstate.io_offset]);
+            sw = SWO_SUCCESS;
+            break;
+
             /* ----------------- Serial -----------------*/
         case 0x4f:
             if (G_gpg_vstate.io_length != 4) {
@@ -361,196 +1697,17 @@ int gpg_apdu_put_data(unsigned int ref) {
             sw = SWO_SUCCESS;
             break;
 
-            /* ----------------- Extended Header list -----------------*/
-        case 0x3FFF: {
-            unsigned int len_e, len_p, len_q;
-            unsigned int endof, reset_cnt;
-            gpg_key_t *keygpg = NULL;
-            // fecth 4D
-            gpg_io_fetch_tl(&t, &l);
-            if (t != 0x4D) {
-                sw = SWO_REFERENCED_DATA_NOT_FOUND;
-                break;
-            }
-            // fecth B8/B6/A4
-            gpg_io_fetch_tl(&t, &l);
-            reset_cnt = 0;
-            switch (t) {
-                case KEY_SIG:
-                    keygpg = &G_gpg_vstate.kslot->sig;
-                    reset_cnt = 0x11111111;
-                    break;
-                case KEY_AUT:
-                    keygpg = &G_gpg_vstate.kslot->aut;
-                    break;
-                case KEY_DEC:
-                    keygpg = &G_gpg_vstate.kslot->dec;
-                    break;
-                default:
-                    break;
-            }
-            if (keygpg == NULL) {
-                sw = SWO_REFERENCED_DATA_NOT_FOUND;
-                break;
-            }
-            // fecth 7f78
-            gpg_io_fetch_tl(&t, &l);
-            if ((t != 0x7f48) || (l > (G_gpg_vstate.io_length - G_gpg_vstate.io_offset))) {
-                sw = SWO_INCORRECT_DATA;
-                break;
-            }
-            len_e = 0;
-            len_p = 0;
-            len_q = 0;
-            endof = G_gpg_vstate.io_offset + l;
-            while (G_gpg_vstate.io_offset < endof) {
-                gpg_io_fetch_tl(&t, &l);
-                if (G_gpg_vstate.io_offset > endof) {
-                    return SWO_INCORRECT_DATA;
-                }
-                switch (t) {
-                    case 0x91:
-                        len_e = l;
-                        break;
-                    case 0x92:
-                        len_p = l;
-                        break;
-                    case 0x93:
-                        len_q = l;
-                        break;
-                    case 0x94:
-                    case 0x95:
-                    case 0x96:
-                    case 0x97:
-                    case 0x99:
-                        break;
-                    default:
-                        return SWO_REFERENCED_DATA_NOT_FOUND;
-                }
-            }
-            // fecth 5f78
-            gpg_io_fetch_tl(&t, &l);
-            if (t != 0x5f48) {
-                sw = SWO_REFERENCED_DATA_NOT_FOUND;
-                break;
-            }
-
-            if (keygpg->attributes.value[0] == KEY_ID_RSA) {
-                unsigned int e = 0;
-                unsigned char *p, *q, *pq;
-                cx_rsa_public_key_t *rsa_pub;
-                cx_rsa_private_key_t *rsa_priv;
-                // check length
-                ksz = U2BE(keygpg->attributes.value, 1) >> 3;
-                rsa_pub = (cx_rsa_public_key_t *) &G_gpg_vstate.work.rsa.public;
-                rsa_priv = (cx_rsa_private_key_t *) &G_gpg_vstate.work.rsa.private;
-                switch (ksz) {
-                    case 2048 / 8:
-                        pkey_size = sizeof(cx_rsa_2048_private_key_t);
-                        pq = G_gpg_vstate.work.rsa.public2048.n;
-                        break;
-                    case 3072 / 8:
-                        pkey_size = sizeof(cx_rsa_3072_private_key_t);
-                        pq = G_gpg_vstate.work.rsa.public3072.n;
-                        break;
-                    case 4096 / 8:
-                        pkey_size = sizeof(cx_rsa_4096_private_key_t);
-                        pq = G_gpg_vstate.work.rsa.public4096.n;
-                        break;
-                    default:
-                        break;
-                }
-                if (pkey_size == 0) {
-                    sw = SWO_INCORRECT_DATA;
-                    break;
-                }
-                ksz = ksz >> 1;
-
-                // fetch e
-                switch (len_e) {
-                    case 4:
-                        e = gpg_io_fetch_u32();
-                        break;
-                    case 3:
-                        e = gpg_io_fetch_u24();
-                        break;
-                    case 2:
-                        e = gpg_io_fetch_u16();
-                        break;
-                    case 1:
-                        e = gpg_io_fetch_u8();
-                        break;
-                    default:
-                        break;
-                }
-                if (e == 0) {
-                    sw = SWO_INCORRECT_DATA;
-                    break;
-                }
+            /* ----------------- Device archive -----------------*/
+        case 0x01FA:
+            // records have been applied by gpg_data_stream_chunk
+            sw = gpg_archive_restore_end();
+            break;
 
-                // move p,q over pub key, this only work because adr<rsa_pub> < adr<p>
-                if ((len_p > ksz) || (len_q > ksz)) {
-                    sw = SWO_INCORRECT_DATA;
-                    break;
-                }
-                p = G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset;
-                q = p + len_p;
-                memmove(pq + ksz - len_p, p, len_p);
-                explicit_bzero(pq, ksz - len_p);
-                memmove(pq + 2 * ksz - len_q, q, len_q);
-                explicit_bzero(pq + ksz, ksz - len_q);
-
-                // regenerate RSA private key
-                unsigned char _e[4];
-                U4BE_ENCODE(_e, 0, e);
-                CX_CHECK(cx_rsa_generate_pair_no_throw(ksz << 1, rsa_pub, rsa_priv, _e, 4, pq));
-
-                // write keys
-                nvm_write(&keygpg->pub_key.rsa, rsa_pub->e, 4);
-                nvm_write(&keygpg->priv_key.rsa, rsa_priv, pkey_size);
-                if (reset_cnt) {
-                    reset_cnt = 0;
-                    nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
-                }
-                sw = SWO_SUCCESS;
-            } else if ((keygpg->attributes.value[0] == KEY_ID_ECDH) ||
-                       (keygpg->attributes.value[0] == KEY_ID_ECDSA) ||
-                       (keygpg->attributes.value[0] == KEY_ID_EDDSA)) {
-                curve = gpg_oid2curve(&keygpg->attributes.value[1], keygpg->attributes.length - 1);
-                if (curve == CX_CURVE_NONE) {
-                    sw = SWO_INCORRECT_DATA;
-                    break;
-                }
-                ksz = gpg_curve2domainlen(curve);
-                if (ksz == len_p) {
-                    G_gpg_vstate.work.ecfp.private.curve = curve;
-                    G_gpg_vstate.work.ecfp.private.d_len = ksz;
-                    memmove(G_gpg_vstate.work.ecfp.private.d,
-                            G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                            ksz);
-                    CX_CHECK(cx_ecfp_generate_pair_no_throw(curve,
-                                                            &G_gpg_vstate.work.ecfp.public,
-                                                            &G_gpg_vstate.work.ecfp.private,
-                                                            1));
-                    nvm_write(&keygpg->pub_key.ecfp,
-                              &G_gpg_vstate.work.ecfp.public,
-                              sizeof(cx_ecfp_public_key_t));
-                    nvm_write(&keygpg->priv_key.ecfp,
-                              &G_gpg_vstate.work.ecfp.private,
-                              sizeof(cx_ecfp_private_key_t));
-                    if (reset_cnt) {
-                        reset_cnt = 0;
-                        nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
-                    }
-                }
-                sw = SWO_SUCCESS;
-            }
-            // --- UNSUPPORTED KEY ---
-            else {
-                sw = SWO_REFERENCED_DATA_NOT_FOUND;
-            }
+            /* ----------------- Extended Header list -----------------*/
+        case 0x3FFF:
+            // key components have been staged by gpg_data_stream_chunk
+            sw = gpg_import_commit();
             break;
-        }  // endof of 3fff
 
             /* ----------------- User -----------------*/
             /* Name */
@@ -569,17 +1726,13 @@ int gpg_apdu_put_data(unsigned int ref) {
             break;
             /* Login data */
         case 0x5E:
-            if (G_gpg_vstate.io_length > sizeof(N_gpg_pstate->login.value)) {
+            if (G_gpg_vstate.io_length > GPG_EXT_PRIVATE_DO_LENGTH) {
                 sw = SWO_WRONG_LENGTH;
                 break;
             }
-            nvm_write((void *) N_gpg_pstate->login.value,
-                      G_gpg_vstate.work.io_buffer,
-                      G_gpg_vstate.io_length);
-            nvm_write((void *) &N_gpg_pstate->login.length,
-                      &G_gpg_vstate.io_length,
-                      sizeof(unsigned int));
-            sw = SWO_SUCCESS;
+            sw = gpg_heap_put(HEAP_HANDLE(ref, HEAP_GLOBAL, 0),
+                              G_gpg_vstate.work.io_buffer,
+                              G_gpg_vstate.io_length);
             break;
             /* Language preferences */
         case 0x5F2D:
@@ -608,39 +1761,24 @@ int gpg_apdu_put_data(unsigned int ref) {
             break;
             /* Uniform resource locator */
         case 0x5F50:
-            if (G_gpg_vstate.io_length > sizeof(N_gpg_pstate->keys[G_gpg_vstate.slot].url.value)) {
+            if (G_gpg_vstate.io_length > GPG_EXT_PRIVATE_DO_LENGTH) {
                 sw = SWO_WRONG_LENGTH;
                 break;
             }
-            nvm_write((void *) N_gpg_pstate->keys[G_gpg_vstate.slot].url.value,
-                      G_gpg_vstate.work.io_buffer,
-                      G_gpg_vstate.io_length);
-            nvm_write((void *) &N_gpg_pstate->keys[G_gpg_vstate.slot].url.length,
-                      &G_gpg_vstate.io_length,
-                      sizeof(unsigned int));
-            sw = SWO_SUCCESS;
+            sw = gpg_heap_put(HEAP_HANDLE(ref, G_gpg_vstate.slot, 0),
+                              G_gpg_vstate.work.io_buffer,
+                              G_gpg_vstate.io_length);
             break;
 
             /* ----------------- Cardholder certificate ----------------- */
         case 0x7F21:
-            ptr_v = NULL;
-            switch (G_gpg_vstate.DO_reccord) {
-                case 0:
-                    ptr_l = &G_gpg_vstate.kslot->aut.CA.length;
-                    ptr_v = G_gpg_vstate.kslot->aut.CA.value;
-                    break;
-                case 1:
-                    ptr_l = &G_gpg_vstate.kslot->sig.CA.length;
-                    ptr_v = G_gpg_vstate.kslot->sig.CA.value;
-                    break;
-                case 2:
-                    ptr_l = &G_gpg_vstate.kslot->dec.CA.length;
-                    ptr_v = G_gpg_vstate.kslot->dec.CA.value;
-                    break;
-                default:
-                    break;
+            if (G_gpg_vstate.io_stream_in) {
+                // the certificate has been written by gpg_data_stream_chunk
+                sw = gpg_heap_stream_commit();
+                break;
             }
-            if (ptr_v == NULL) {
+            cert_key = gpg_data_cert_key();
+            if (cert_key == 0) {
                 sw = SWO_REFERENCED_DATA_NOT_FOUND;
                 break;
             }
@@ -648,9 +1786,9 @@ int gpg_apdu_put_data(unsigned int ref) {
                 sw = SWO_WRONG_LENGTH;
                 break;
             }
-            nvm_write(ptr_v, G_gpg_vstate.work.io_buffer, G_gpg_vstate.io_length);
-            nvm_write(ptr_l, &G_gpg_vstate.io_length, sizeof(unsigned int));
-            sw = SWO_SUCCESS;
+            sw = gpg_heap_put(HEAP_HANDLE(ref, G_gpg_vstate.slot, cert_key),
+                              G_gpg_vstate.work.io_buffer,
+                              G_gpg_vstate.io_length);
             break;
 
             /* ----------------- Algorithm attributes ----------------- */
@@ -661,51 +1799,18 @@ int gpg_apdu_put_data(unsigned int ref) {
         case 0xC2:
             ptr_l = &G_gpg_vstate.kslot->dec.attributes.length;
             ptr_v = G_gpg_vstate.kslot->dec.attributes.value;
-#ifdef NO_DECRYPT_cv25519
-            decKey = true;
-#endif
             goto WRITE_ATTRIBUTES;
         case 0xC3:
             ptr_l = &G_gpg_vstate.kslot->aut.attributes.length;
             ptr_v = G_gpg_vstate.kslot->aut.attributes.value;
             goto WRITE_ATTRIBUTES;
         WRITE_ATTRIBUTES:
-            if (G_gpg_vstate.io_length > 12) {
-                sw = SWO_WRONG_LENGTH;
-                break;
-            }
-            switch (G_gpg_vstate.work.io_buffer[0]) {
-                case KEY_ID_RSA:
-                    ksz = U2BE(G_gpg_vstate.work.io_buffer, 1);
-                    if ((ksz != 2048) && (ksz != 3072) && (ksz != 4096)) {
-                        sw = SWO_INCORRECT_DATA;
-                    } else {
-                        sw = SWO_SUCCESS;
-                    }
-                    break;
-                case KEY_ID_ECDH:
-                case KEY_ID_ECDSA:
-                case KEY_ID_EDDSA:
-                    curve =
-                        gpg_oid2curve(G_gpg_vstate.work.io_buffer + 1, G_gpg_vstate.io_length - 1);
-#ifdef NO_DECRYPT_cv25519
-                    if ((decKey) && (curve == CX_CURVE_Curve25519)) {
-                        sw = SWO_INCORRECT_DATA;
-                        break;
-                    }
-#endif
-                    if (curve == CX_CURVE_NONE) {
-                        sw = SWO_INCORRECT_DATA;
-                    } else {
-                        sw = SWO_SUCCESS;
-                    }
-                    break;
-                default:
-                    sw = SWO_INCORRECT_DATA;
-                    break;
-            }
-
+            sw = gpg_data_check_attributes(ref,
+                                           G_gpg_vstate.work.io_buffer,
+                                           G_gpg_vstate.io_length);
             if (sw == SWO_SUCCESS) {
+                gpg_gen_pub_invalidate(
+                    (gpg_key_t *) (ptr_v - offsetof(gpg_key_t, attributes.value)));
                 nvm_write(ptr_v, G_gpg_vstate.work.io_buffer, G_gpg_vstate.io_length);
                 nvm_write(ptr_l, &G_gpg_vstate.io_length, sizeof(unsigned int));
             }
@@ -830,6 +1935,8 @@ int gpg_apdu_put_data(unsigned int ref) {
                 break;
             }
             nvm_write(ptr_v, G_gpg_vstate.work.io_buffer, 2);
+            // a new setting revokes the current approval window
+            gpg_pso_uif_reset((gpg_key_t *) (ptr_v - offsetof(gpg_key_t, UIF)));
             sw = SWO_SUCCESS;
             break;
 
@@ -839,12 +1946,282 @@ int gpg_apdu_put_data(unsigned int ref) {
             break;
     }
 
-    gpg_io_discard(1);
     return sw;
 end:
     return error;
 }
 
+/**
+ * Parse the header of a DO in a bulk container: tag on 2 bytes, as P1-P2
+ * of put_data, and BER length
+ *
+ * @param[in]     bulk container
+ * @param[in]     len container length
+ * @param[in,out] off DO offset, then value offset
+ * @param[out]    ref DO tag
+ * @param[out]    l value length
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_data_bulk_tlv(const unsigned char *bulk,
+                             unsigned int len,
+                             unsigned int *off,
+                             unsigned int *ref,
+                             unsigned int *l) {
+    unsigned int o = *off;
+
+    if (o + 3 > len) {
+        return SWO_INCORRECT_DATA;
+    }
+    *ref = U2BE(bulk, o);
+    o += 2;
+    switch (bulk[o]) {
+        case 0x81:
+            if (o + 2 > len) {
+                return SWO_INCORRECT_DATA;
+            }
+            *l = bulk[o + 1];
+            o += 2;
+            break;
+        case 0x82:
+            if (o + 3 > len) {
+                return SWO_INCORRECT_DATA;
+            }
+            *l = U2BE(bulk, o + 1);
+            o += 3;
+            break;
+        default:
+            if (bulk[o] & 0x80) {
+                return SWO_INCORRECT_DATA;
+            }
+            *l = bulk[o];
+            o += 1;
+            break;
+    }
+    if (*l > len - o) {
+        return SWO_INCORRECT_DATA;
+    }
+    *off = o;
+    return SWO_SUCCESS;
+}
+
+/**
+ * Check a DO value of a bulk container, before anything is written
+ * Only the PW3 protected user data, attributes, fingerprints, dates and
+ * UIF are accepted
+ *
+ * @param[in]     ref DO tag
+ * @param[in]     value DO value
+ * @param[in]     len value length
+ * @param[in,out] heap NVM heap space needed by the container
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_data_bulk_check(unsigned int ref,
+                               const unsigned char *value,
+                               unsigned int len,
+                               int *heap) {
+    const unsigned char *old = NULL;
+    unsigned int handle = 0, old_len, min = 0, max = 0;
+
+    switch (ref) {
+        case 0x0102:
+        case 0x0104:
+        case 0x5E:
+            handle = HEAP_HANDLE(ref, HEAP_GLOBAL, 0);
+            max = GPG_EXT_PRIVATE_DO_LENGTH;
+            break;
+        case 0x5F50:
+            handle = HEAP_HANDLE(ref, G_gpg_vstate.slot, 0);
+            max = GPG_EXT_PRIVATE_DO_LENGTH;
+            break;
+        case 0x4F:
+            min = max = 4;
+            break;
+        case 0x5B:
+            max = sizeof(N_gpg_pstate->name.value);
+            break;
+        case 0x5F2D:
+            max = sizeof(N_gpg_pstate->lang.value);
+            break;
+        case 0x5F35:
+            min = max = sizeof(N_gpg_pstate->salutation);
+            break;
+        case 0xC1:
+        case 0xC2:
+        case 0xC3:
+            return gpg_data_check_attributes(ref, value, len);
+        case 0xC7:
+        case 0xC8:
+        case 0xC9:
+        case 0xCA:
+        case 0xCB:
+        case 0xCC:
+            min = max = 20;
+            break;
+        case 0xCE:
+        case 0xCF:
+        case 0xD0:
+            min = max = 4;
+            break;
+        case 0xD6:
+        case 0xD7:
+        case 0xD8:
+            min = max = 2;
+            break;
+        default:
+            return SWO_REFERENCED_DATA_NOT_FOUND;
+    }
+    if ((len < min) || (len > max)) {
+        return SWO_WRONG_LENGTH;
+    }
+    if (handle != 0) {
+        old_len = gpg_heap_get(handle, &old);
+        *heap += (len != 0) ? HEAP_HEADER_LENGTH + len : 0;
+        *heap -= (old_len != 0) ? HEAP_HEADER_LENGTH + old_len : 0;
+    }
+    return SWO_SUCCESS;
+}
+
+/**
+ * Apply a checked bulk container
+ * DOs which do not grow the heap go first: the heap level then only rises up
+ * to the checked one, so that each heap write fits
+ *
+ * @param[in] bulk container
+ * @param[in] len container length
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_data_bulk_apply(const unsigned char *bulk, unsigned int len) {
+    unsigned int off, ref = 0, l = 0, pass;
+    int grow;
+    int sw = SWO_SUCCESS;
+
+    for (pass = 0; pass < 2; pass++) {
+        for (off = 0; (sw == SWO_SUCCESS) && (off < len); off += l) {
+            gpg_data_bulk_tlv(bulk, len, &off, &ref, &l);
+            grow = 0;
+            gpg_data_bulk_check(ref, bulk + off, l, &grow);
+            if ((grow > 0) != (pass == 1)) {
+                continue;
+            }
+            gpg_io_discard(0);
+            gpg_io_insert(bulk + off, l);
+            G_gpg_vstate.io_offset = 0;
+            sw = gpg_data_put(ref);
+        }
+    }
+    return sw;
+}
+
+/**
+ * Write a list of DOs at once
+ * The container is fully checked before the first write, heap room
+ * included: on error nothing is modified. It is then staged in NVM and
+ * applied from there, so that a power loss is completed by gpg_init
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_data_put_bulk(void) {
+    unsigned int refs[GPG_BULK_MAX_DO];
+    unsigned int len, off, ref = 0, l = 0, n = 0, i, slot;
+    unsigned int pending = 1;
+    const unsigned char *bulk;
+    int heap = 0;
+    int sw = SWO_SUCCESS;
+
+    len = G_gpg_vstate.io_length - G_gpg_vstate.io_offset;
+    if (len > GPG_BULK_MAX_LENGTH) {
+        return SWO_WRONG_LENGTH;
+    }
+    bulk = G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset;
+
+    // --- check all ---
+    for (off = 0; (sw == SWO_SUCCESS) && (off < len); off += l) {
+        sw = gpg_data_bulk_tlv(bulk, len, &off, &ref, &l);
+        if (sw != SWO_SUCCESS) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (refs[i] == ref) {
+                sw = SWO_INCORRECT_DATA;
+            }
+        }
+        if (n == GPG_BULK_MAX_DO) {
+            sw = SWO_INCORRECT_DATA;
+        }
+        if (sw != SWO_SUCCESS) {
+            break;
+        }
+        refs[n++] = ref;
+        sw = gpg_data_bulk_check(ref, bulk + off, l, &heap);
+    }
+    if ((sw == SWO_SUCCESS) && (heap > (int) gpg_heap_available())) {
+        sw = SWO_NOT_ENOUGH_MEMORY_SPACE;
+    }
+    if (sw != SWO_SUCCESS) {
+        return sw;
+    }
+
+    // --- stage, the pending flag being written last ---
+    slot = G_gpg_vstate.slot;
+    nvm_write((void *) N_gpg_pstate->bulk.value, (void *) bulk, len);
+    nvm_write((void *) &N_gpg_pstate->bulk.length, &len, sizeof(unsigned int));
+    nvm_write((void *) &N_gpg_pstate->bulk.slot, &slot, sizeof(unsigned int));
+    nvm_write((void *) &N_gpg_pstate->bulk.pending, &pending, sizeof(unsigned int));
+
+    // --- write all ---
+    sw = gpg_data_bulk_apply((const unsigned char *) N_gpg_pstate->bulk.value, len);
+    pending = 0;
+    nvm_write((void *) &N_gpg_pstate->bulk.pending, &pending, sizeof(unsigned int));
+    return sw;
+}
+
+/**
+ * Apply again a bulk container interrupted by a power loss
+ * DO writes only depend on the container, so DOs already written are
+ * written again as is
+ *
+ */
+void gpg_data_bulk_replay(void) {
+    unsigned int pending = 0;
+
+    if (!N_gpg_pstate->bulk.pending) {
+        return;
+    }
+    G_gpg_vstate.slot = N_gpg_pstate->bulk.slot;
+    G_gpg_vstate.kslot = gpg_install_slot_get(G_gpg_vstate.slot);
+    gpg_data_bulk_apply((const unsigned char *) N_gpg_pstate->bulk.value,
+                        MIN(N_gpg_pstate->bulk.length, GPG_BULK_MAX_LENGTH));
+    nvm_write((void *) &N_gpg_pstate->bulk.pending, &pending, sizeof(unsigned int));
+    gpg_state_counter_bump();
+}
+
+/**
+ * APDU handler to write a DO (Data Object) to the card
+ *
+ * @param[in] ref DO tag
+ *
+ * @return Status Word
+ *
+ */
+int gpg_apdu_put_data(unsigned int ref) {
+    int sw;
+
+    if (ref == 0x01FC) {
+        sw = gpg_data_put_bulk();
+    } else {
+        sw = gpg_data_put(ref);
+    }
+    gpg_io_discard(1);
+    return sw;
+}
+
 /**
  * Init an encryption key to protect Private Key
  * Used for Backup/Restore
@@ -1031,6 +2408,7 @@ int gpg_apdu_put_key_data(unsigned int ref) {
         default:
             return SWO_INCORRECT_DATA;
     }
+    gpg_gen_pub_invalidate(keygpg);
 
     /* unsigned int target_id = */
     gpg_io_fetch_u32();
@@ -50,7 +50,8 @@ static int gpg_check_access_ins() {
             break;
 
         case INS_PSO:
-            if ((G_gpg_vstate.io_p1p2 == PSO_CDS) && gpg_pin_is_verified(PIN_ID_PW1)) {
+            if (((G_gpg_vstate.io_p1p2 == PSO_CDS) || (G_gpg_vstate.io_p1p2 == PSO_CDS_BATCH)) &&
+                gpg_pin_is_verified(PIN_ID_PW1)) {
                 // pso:sign
                 if (N_gpg_pstate->PW_status[0] == 0) {
                     gpg_pin_set_verified(PIN_ID_PW1, 0);
@@ -58,7 +59,10 @@ static int gpg_check_access_ins() {
                 sw = SWO_SUCCESS;
                 break;
             }
-            if (((G_gpg_vstate.io_p1p2 == PSO_DEC) || (G_gpg_vstate.io_p1p2 == PSO_ENC)) &&
+            if (((G_gpg_vstate.io_p1p2 == PSO_DEC) || (G_gpg_vstate.io_p1p2 == PSO_DEC_BATCH) ||
+                 (G_gpg_vstate.io_p1p2 == PSO_ENC) ||
+                 ((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_ENC_STREAM) ||
+                 ((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_DEC_STREAM)) &&
                 gpg_pin_is_verified(PIN_ID_PW2)) {
                 // pso:dec/enc
                 sw = SWO_SUCCESS;
@@ -83,6 +87,7 @@ static int gpg_check_access_ins() {
 #endif
         case INS_SELECT:
         case INS_GET_DATA:
+        case INS_GET_DATA_ODD:
         case INS_GET_NEXT_DATA:
         case INS_VERIFY:
         case INS_CHANGE_REFERENCE_DATA:
@@ -119,6 +124,8 @@ static int gpg_check_access_read_DO() {
         case 0x01F1:
         case 0x01F2:
         case 0x01F8:
+        case 0x01FB:
+        case 0x01FD:
         case 0x006E:
         case 0x0065:
         case 0x0073:
@@ -168,6 +175,7 @@ static int gpg_check_access_read_DO() {
         case 0x00A4:
         case 0x00B8:
         case 0x0104:
+        case 0x01FA:
             if (gpg_pin_is_verified(PIN_ID_PW3)) {
                 sw = SWO_SUCCESS;
             }
@@ -194,6 +202,7 @@ static int gpg_check_access_write_DO() {
         case 0x0101:
         case 0x0103:
         case 0x01F2:
+        case 0x01FB:
             if (gpg_pin_is_verified(PIN_ID_PW2)) {
                 sw = SWO_SUCCESS;
             }
@@ -206,6 +215,8 @@ static int gpg_check_access_write_DO() {
         case 0x0104:
         case 0x01F1:
         case 0x01F8:
+        case 0x01FA:
+        case 0x01FC:
         case 0x005E:
         case 0x005B:
         case 0x5F2D:
@@ -251,6 +262,24 @@ static int gpg_check_access_write_DO() {
     return sw;
 }
 
+/**
+ * Check if a successful PUT DATA changed the card state (DO 01FD)
+ * RAM only vendor DOs (ECDH cache) do not, and an archive restore counts
+ * once applied, not after its check pass
+ *
+ * @return 1 if the state counter must be bumped, 0 otherwise
+ *
+ */
+static int gpg_put_data_changes_state(void) {
+    switch (G_gpg_vstate.io_p1p2) {
+        case 0x01FA:
+        case 0x01FB:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
 /**
  * APDU Handler: dispatch command
  *
@@ -300,6 +329,13 @@ int gpg_dispatch() {
         return SWO_NO_INPUT_DATA_AVAILABLE;
     }
 
+    /* Partially applied archive: only the restore can go on */
+    if (N_gpg_pstate->restore_pending && (G_gpg_vstate.io_ins != INS_VERIFY) &&
+        !(((G_gpg_vstate.io_ins == INS_PUT_DATA) || (G_gpg_vstate.io_ins == INS_PUT_DATA_ODD)) &&
+          (G_gpg_vstate.io_p1p2 == 0x01FA))) {
+        return SWO_CONDITIONS_NOT_SATISFIED;
+    }
+
     /* Process */
     sw = gpg_check_access_ins();
     if (sw != SWO_SUCCESS) {
@@ -308,6 +344,7 @@ int gpg_dispatch() {
 
     switch (G_gpg_vstate.io_ins) {
         case INS_EXIT:
+            gpg_pso_ecdh_cache_clear();
             app_exit();
             sw = SWO_SUCCESS;
             break;
@@ -371,6 +408,14 @@ int gpg_dispatch() {
             sw = gpg_apdu_get_next_data(G_gpg_vstate.io_p1p2);
             break;
 
+        case INS_GET_DATA_ODD:
+            sw = gpg_check_access_read_DO();
+            if (sw != SWO_SUCCESS) {
+                break;
+            }
+            sw = gpg_apdu_get_data_slice(G_gpg_vstate.io_p1p2);
+            break;
+
         case INS_PUT_DATA_ODD:
         case INS_PUT_DATA:
             sw = gpg_check_access_write_DO();
@@ -387,6 +432,9 @@ int gpg_dispatch() {
                     sw = gpg_apdu_put_data(G_gpg_vstate.io_p1p2);
                     break;
             }
+            if ((sw == SWO_SUCCESS) && gpg_put_data_changes_state()) {
+                gpg_state_counter_bump();
+            }
             break;
 
             /* --- PIN -- */
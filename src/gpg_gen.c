@@ -23,7 +23,8 @@
  * Derivate the App Path from the Master Seed for a specific slot
  *
  * @param[in] slot Selected slot
- * @param[out] seed 32 bytes seed for given slot
+ * @param[out] seed buffer of at least 64 bytes (BIP32 private key output),
+ *                  the first 32 bytes being the seed for given slot
  *
  * @return Status Word
  *
@@ -64,22 +65,27 @@ int gpg_pso_derive_key_seed(unsigned char *Sn,
                             unsigned int Ski_len) {
     unsigned char h[32];
     cx_err_t error = CX_INTERNAL_ERROR;
+    unsigned int mark;
+    cx_sha256_t *sha256;
+    cx_sha3_t *sha3;
     U2BE_ENCODE(h, 0, idx);
 
-    cx_sha256_init(&G_gpg_vstate.work.md.sha256);
-    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256, 0, Sn, 32, NULL, 0));
-    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256,
-                              0,
-                              (unsigned char *) key_name,
-                              4,
-                              NULL,
-                              0));
-    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256, CX_LAST, h, 2, h, 32));
-    CX_CHECK(cx_shake256_init_no_throw(&G_gpg_vstate.work.md.sha3, Ski_len));
-    CX_CHECK(cx_sha3_update(&G_gpg_vstate.work.md.sha3, h, 32));
-    CX_CHECK(cx_sha3_final(&G_gpg_vstate.work.md.sha3, Ski));
+    // one hash context at a time
+    mark = gpg_io_scratch_mark();
+    sha256 = gpg_io_scratch_alloc(MAX(sizeof(cx_sha3_t), sizeof(cx_sha256_t)));
+    sha3 = (cx_sha3_t *) sha256;
+
+    cx_sha256_init(sha256);
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha256, 0, Sn, 32, NULL, 0));
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha256, 0, (unsigned char *) key_name, 4, NULL, 0));
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha256, CX_LAST, h, 2, h, 32));
+    CX_CHECK(cx_shake256_init_no_throw(sha3, Ski_len));
+    CX_CHECK(cx_sha3_update(sha3, h, 32));
+    CX_CHECK(cx_sha3_final(sha3, Ski));
 
 end:
+    gpg_io_scratch_release(mark);
+    explicit_bzero(h, sizeof(h));
     if (error != CX_OK) {
         return error;
     }
@@ -91,18 +97,18 @@ end:
  *
  * @param[in]  keygpg pointer on key structure
  * @param[in]  name key name: 'sig ', 'auth ', 'dec '
+ * @param[in]  slot_seed slot seed for a deterministic key, NULL for a random one
  *
  * @return Status Word
  *
  */
-static int gpg_gen_rsa_kyey(gpg_key_t *keygpg, uint8_t *name) {
+static int gpg_gen_rsa_kyey(gpg_key_t *keygpg, uint8_t *name, const unsigned char *slot_seed) {
     cx_rsa_public_key_t *rsa_pub = NULL;
     cx_rsa_private_key_t *rsa_priv = NULL;
     uint8_t *pq = NULL;
-    uint32_t ksz = 0, reset_cnt = 0, pkey_size = 0;
+    uint32_t ksz = 0, pkey_size = 0;
     int sw = SWO_UNKNOWN;
     cx_err_t error = CX_INTERNAL_ERROR;
-    uint8_t seed[66] = {0};
 
     ksz = U2BE(keygpg->attributes.value, 1) >> 3;
     rsa_pub = (cx_rsa_public_key_t *) &G_gpg_vstate.work.rsa.public;
@@ -124,23 +130,16 @@ static int gpg_gen_rsa_kyey(gpg_key_t *keygpg, uint8_t *name) {
         return SWO_INCORRECT_DATA;
     }
 
-    if ((G_gpg_vstate.io_p2 == SEEDED_MODE) || (G_gpg_vstate.seed_mode)) {
+    if (slot_seed != NULL) {
         pq = &rsa_pub->n[0];
         unsigned int size;
         size = ksz >> 1;
-        sw = gpg_pso_derive_slot_seed(G_gpg_vstate.slot, seed);
-        if (sw != SWO_SUCCESS) {
-            explicit_bzero(seed, sizeof(seed));
-            return sw;
-        }
-        sw = gpg_pso_derive_key_seed(seed, name, 1, pq, size);
+        sw = gpg_pso_derive_key_seed((unsigned char *) slot_seed, name, 1, pq, size);
         if (sw != SWO_SUCCESS) {
-            explicit_bzero(seed, sizeof(seed));
             return sw;
         }
-        sw = gpg_pso_derive_key_seed(seed, name, 2, pq + size, size);
+        sw = gpg_pso_derive_key_seed((unsigned char *) slot_seed, name, 2, pq + size, size);
         if (sw != SWO_SUCCESS) {
-            explicit_bzero(seed, sizeof(seed));
             return sw;
         }
         *pq |= 0x80;
@@ -160,13 +159,10 @@ static int gpg_gen_rsa_kyey(gpg_key_t *keygpg, uint8_t *name) {
     nvm_write(&keygpg->priv_key.rsa, rsa_priv, pkey_size);
     nvm_write(&keygpg->pub_key.rsa[0], rsa_pub->e, 4);
 
-    nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
     gpg_io_clear();
-    explicit_bzero(seed, sizeof(seed));
     return SWO_SUCCESS;
 
 end:
-    explicit_bzero(seed, sizeof(seed));
     return error;
 }
 
@@ -217,13 +213,14 @@ static int gpg_read_rsa_kyey(gpg_key_t *keygpg) {
  *
  * @param[in]  keygpg pointer on key structure
  * @param[in]  name key name: 'sig ', 'auth ', 'dec '
+ * @param[in]  slot_seed slot seed for a deterministic key, NULL for a random one
  *
  * @return Status Word
  *
  */
-static int gpg_gen_ecc_kyey(gpg_key_t *keygpg, uint8_t *name) {
+static int gpg_gen_ecc_kyey(gpg_key_t *keygpg, uint8_t *name, const unsigned char *slot_seed) {
     uint32_t curve = 0, keepprivate = 0;
-    uint32_t ksz = 0, reset_cnt = 0;
+    uint32_t ksz = 0;
     int sw = SWO_UNKNOWN;
     cx_err_t error = CX_INTERNAL_ERROR;
     uint8_t seed[66] = {0};
@@ -232,14 +229,9 @@ static int gpg_gen_ecc_kyey(gpg_key_t *keygpg, uint8_t *name) {
     if (curve == CX_CURVE_NONE) {
         return SWO_REFERENCED_DATA_NOT_FOUND;
     }
-    if ((G_gpg_vstate.io_p2 == SEEDED_MODE) || (G_gpg_vstate.seed_mode)) {
+    if (slot_seed != NULL) {
         ksz = gpg_curve2domainlen(curve);
-        sw = gpg_pso_derive_slot_seed(G_gpg_vstate.slot, seed);
-        if (sw != SWO_SUCCESS) {
-            explicit_bzero(seed, sizeof(seed));
-            return sw;
-        }
-        sw = gpg_pso_derive_key_seed(seed, name, 1, seed, ksz);
+        sw = gpg_pso_derive_key_seed((unsigned char *) slot_seed, name, 1, seed, ksz);
         if (sw != SWO_SUCCESS) {
             explicit_bzero(seed, sizeof(seed));
             return sw;
@@ -258,7 +250,6 @@ static int gpg_gen_ecc_kyey(gpg_key_t *keygpg, uint8_t *name) {
               sizeof(cx_ecfp_private_key_t));
     nvm_write(&keygpg->pub_key.ecfp, &G_gpg_vstate.work.ecfp.public, sizeof(cx_ecfp_public_key_t));
 
-    nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
     gpg_io_clear();
     error = SWO_SUCCESS;
 
@@ -336,6 +327,500 @@ end:
     return error;
 }
 
+/* ----------------------------------------------------------------------- */
+/* ---                     Generate and commit                        --- */
+/* ----------------------------------------------------------------------- */
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+// hashed data for an RSA 4096 v5 fingerprint: headers (15), n and e MPIs
+#define GPG_GEN_FPR_MAX_LENGTH (15 + 2 + 512 + 2 + 4)
+
+/**
+ * SHA-1 digest, only used for OpenPGP v4 fingerprints
+ *
+ * @param[in]  msg message
+ * @param[in]  len message length
+ * @param[out] digest 20 bytes digest
+ *
+ */
+static void gpg_gen_sha1(const unsigned char *msg, unsigned int len, unsigned char *digest) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    uint32_t w[16], a, b, c, d, e, f, k, tmp;
+    unsigned char blk[64];
+    unsigned int nb, j, i, n;
+
+    // message, 0x80, zeros and the 64 bits length fill whole blocks
+    nb = (len + 8) / 64 + 1;
+    for (j = 0; j < nb; j++) {
+        for (i = 0; i < 64; i++) {
+            n = j * 64 + i;
+            blk[i] = (n < len) ? msg[n] : ((n == len) ? 0x80 : 0);
+        }
+        if (j == nb - 1) {
+            U4BE_ENCODE(blk, 56, len >> 29);
+            U4BE_ENCODE(blk, 60, len << 3);
+        }
+        a = h[0];
+        b = h[1];
+        c = h[2];
+        d = h[3];
+        e = h[4];
+        for (i = 0; i < 80; i++) {
+            if (i < 16) {
+                w[i] = U4BE(blk, 4 * i);
+            } else {
+                tmp = w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15];
+                w[i & 15] = ROL32(tmp, 1);
+            }
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            tmp = ROL32(a, 5) + f + e + k + w[i & 15];
+            e = d;
+            d = c;
+            c = ROL32(b, 30);
+            b = a;
+            a = tmp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (i = 0; i < 5; i++) {
+        U4BE_ENCODE(digest, 4 * i, h[i]);
+    }
+    explicit_bzero(w, sizeof(w));
+    explicit_bzero(blk, sizeof(blk));
+}
+/**
+ * Append an OpenPGP MPI (RFC 4880, 3.2)
+ *
+ * @param[out] out MPI
+ * @param[in]  prefix native point prefix (0x40), 0 for none
+ * @param[in]  v value, big endian
+ * @param[in]  len value length
+ *
+ * @return MPI length
+ *
+ */
+static unsigned int gpg_gen_mpi(unsigned char *out,
+                                unsigned char prefix,
+                                const unsigned char *v,
+                                unsigned int len) {
+    unsigned int n = 2, bits;
+    unsigned char msb;
+
+    if (prefix != 0) {
+        out[n++] = prefix;
+    } else {
+        while ((len != 0) && (*v == 0)) {
+            v++;
+            len--;
+        }
+    }
+    memmove(out + n, v, len);
+    n += len;
+    bits = 8 * (n - 2);
+    if (n > 2) {
+        for (msb = out[2]; (msb & 0x80) == 0; msb <<= 1) {
+            bits--;
+        }
+    }
+    U2BE_ENCODE(out, 0, bits);
+    return n;
+}
+
+/**
+ * Parse one TLV of the public key template
+ *
+ * @param[in]  p TLV
+ * @param[out] tag tag, on one byte
+ * @param[out] len value length
+ *
+ * @return value
+ *
+ */
+static const unsigned char *gpg_gen_tlv(const unsigned char *p,
+                                        unsigned int *tag,
+                                        unsigned int *len) {
+    *tag = p[0];
+    switch (p[1]) {
+        case 0x81:
+            *len = p[2];
+            return p + 3;
+        case 0x82:
+            *len = U2BE(p, 2);
+            return p + 4;
+        default:
+            *len = p[1];
+            return p + 2;
+    }
+}
+
+/**
+ * Compute the fingerprint of a generated key, then store it with its date
+ * The public key is taken from the 7F49 template ending the response, the
+ * fingerprint is appended to it
+ *
+ * @param[in]  keygpg generated key
+ * @param[in]  pub public key template value (inside 7F49)
+ * @param[in]  pub_len template value length
+ * @param[in]  fpr_tag fingerprint DO tag (C7, C8, C9)
+ * @param[in]  date creation timestamp, big endian
+ * @param[in]  v5 compute a v5 fingerprint, truncated to 20 bytes
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_gen_commit(gpg_key_t *keygpg,
+                          const unsigned char *pub,
+                          unsigned int pub_len,
+                          unsigned int fpr_tag,
+                          const unsigned char *date,
+                          unsigned int v5) {
+    const unsigned char *v, *n = NULL, *e = NULL, *w = NULL;
+    unsigned int tag, len, n_len = 0, e_len = 0, w_len = 0, off, hdr, body, curve;
+    unsigned char *msg;
+    unsigned char digest[32];
+    unsigned int mark;
+    cx_sha256_t sha256;
+    cx_err_t error = CX_INTERNAL_ERROR;
+
+    // public key components
+    for (off = 0; off < pub_len; off = (v - pub) + len) {
+        v = gpg_gen_tlv(pub + off, &tag, &len);
+        if (tag == 0x81) {
+            n = v;
+            n_len = len;
+        } else if (tag == 0x82) {
+            e = v;
+            e_len = len;
+        } else if (tag == 0x86) {
+            w = v;
+            w_len = len;
+        }
+    }
+
+    // hashed data: 0x99 and 2 bytes length (v4), or 0x9A and 4 bytes length (v5),
+    // then version, date, algorithm, [v5: 4 bytes key material length], key material
+    mark = gpg_io_scratch_mark();
+    msg = gpg_io_scratch_alloc(GPG_GEN_FPR_MAX_LENGTH);
+    hdr = v5 ? 5 : 3;
+    off = hdr;
+    msg[off++] = v5 ? 5 : 4;
+    memmove(msg + off, date, 4);
+    off += 4;
+    msg[off++] = keygpg->attributes.value[0];
+    if (v5) {
+        off += 4;
+    }
+    body = off;
+    if (keygpg->attributes.value[0] == KEY_ID_RSA) {
+        if ((n == NULL) || (e == NULL)) {
+            error = SWO_REFERENCED_DATA_NOT_FOUND;
+            goto end;
+        }
+        off += gpg_gen_mpi(msg + off, 0, n, n_len);
+        off += gpg_gen_mpi(msg + off, 0, e, e_len);
+    } else {
+        if (w == NULL) {
+            error = SWO_REFERENCED_DATA_NOT_FOUND;
+            goto end;
+        }
+        curve = gpg_oid2curve(keygpg->attributes.value + 1, keygpg->attributes.length - 1);
+        msg[off++] = keygpg->attributes.length - 1;
+        memmove(msg + off, keygpg->attributes.value + 1, keygpg->attributes.length - 1);
+        off += keygpg->attributes.length - 1;
+        if ((curve == CX_CURVE_Ed25519) || (curve == CX_CURVE_Curve25519)) {
+            off += gpg_gen_mpi(msg + off, 0x40, w, w_len);
+        } else {
+            off += gpg_gen_mpi(msg + off, 0, w, w_len);
+        }
+        if (keygpg->attributes.value[0] == KEY_ID_ECDH) {
+            // KDF parameters: SHA256/AES128, SHA384/AES256 or SHA512/AES256
+            msg[off++] = 3;
+            msg[off++] = 1;
+            len = gpg_curve2domainlen(curve);
+            if ((curve == CX_CURVE_Curve25519) || (len <= 32)) {
+                msg[off++] = 8;
+                msg[off++] = 7;
+            } else if (len <= 48) {
+                msg[off++] = 9;
+                msg[off++] = 9;
+            } else {
+                msg[off++] = 10;
+                msg[off++] = 9;
+            }
+        }
+    }
+
+    if (v5) {
+        msg[0] = 0x9A;
+        U4BE_ENCODE(msg, 1, off - hdr);
+        U4BE_ENCODE(msg, body - 4, off - body);
+        CX_CHECK(cx_sha256_init_no_throw(&sha256));
+        CX_CHECK(cx_hash_no_throw((cx_hash_t *) &sha256, CX_LAST, msg, off, digest, 32));
+    } else {
+        msg[0] = 0x99;
+        U2BE_ENCODE(msg, 1, off - hdr);
+        gpg_gen_sha1(msg, off, digest);
+    }
+
+    nvm_write(keygpg->fingerprints, digest, 20);
+    nvm_write(keygpg->date, (void *) date, 4);
+    gpg_io_insert_tlv(fpr_tag, 20, digest);
+    error = SWO_SUCCESS;
+
+end:
+    gpg_io_scratch_release(mark);
+    explicit_bzero(digest, sizeof(digest));
+    return error;
+}
+
+/* ----------------------------------------------------------------------- */
+/* ---                          Key pairs                              --- */
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Get a key of a slot from its CRT tag
+ *
+ * @param[in]  kslot key slot
+ * @param[in]  t CRT tag: KEY_SIG, KEY_DEC or KEY_AUT
+ * @param[out] name key name: 'sig ', 'auth ', 'dec '
+ * @param[out] fpr_tag fingerprint DO tag (C7, C8, C9)
+ *
+ * @return key, NULL for an unknown tag
+ *
+ */
+static gpg_key_t *gpg_gen_get_key(gpg_key_slot_t *kslot,
+                                  unsigned int t,
+                                  uint8_t **name,
+                                  unsigned int *fpr_tag) {
+    switch (t) {
+        case KEY_SIG:
+            *name = (unsigned char *) PIC("sig ");
+            *fpr_tag = 0xC7;
+            return &kslot->sig;
+        case KEY_AUT:
+            *name = (unsigned char *) PIC("aut ");
+            *fpr_tag = 0xC9;
+            return &kslot->aut;
+        case KEY_DEC:
+            *name = (unsigned char *) PIC("dec ");
+            *fpr_tag = 0xC8;
+            return &kslot->dec;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Get the heap handle of a key public template
+ *
+ * @param[in]  keygpg pointer on key structure, in a slot
+ *
+ * @return handle
+ *
+ */
+static unsigned int gpg_gen_pub_handle(const gpg_key_t *keygpg) {
+    const gpg_key_slot_t *kslot;
+    unsigned int slot, key;
+
+    slot = ((const unsigned char *) keygpg - (const unsigned char *) &N_gpg_pstate->keys[0]) /
+           sizeof(gpg_key_slot_t);
+    LEDGER_ASSERT(slot < GPG_KEYS_SLOTS, "Bad key!");
+    kslot = (const gpg_key_slot_t *) &N_gpg_pstate->keys[slot];
+    if (keygpg == &kslot->sig) {
+        key = 0xC1;
+    } else if (keygpg == &kslot->dec) {
+        key = 0xC2;
+    } else {
+        key = 0xC3;
+    }
+    return HEAP_HANDLE(HEAP_CACHE_TAG, slot, key);
+}
+
+/**
+ * Drop the cached public template of a key, to be called before the key
+ * is modified
+ *
+ * @param[in]  keygpg pointer on key structure, in a slot
+ *
+ */
+void gpg_gen_pub_invalidate(const gpg_key_t *keygpg) {
+    gpg_heap_put(gpg_gen_pub_handle(keygpg), NULL, 0);
+}
+
+/**
+ * Generate a key pair according to its attributes and writes it in NVRam
+ *
+ * @param[in]  keygpg pointer on key structure
+ * @param[in]  name key name: 'sig ', 'auth ', 'dec '
+ * @param[in]  slot_seed slot seed for a deterministic key, NULL for a random one
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_gen_key_pair(gpg_key_t *keygpg, uint8_t *name, const unsigned char *slot_seed) {
+    gpg_gen_pub_invalidate(keygpg);
+    if (keygpg->attributes.value[0] == KEY_ID_RSA) {
+        return gpg_gen_rsa_kyey(keygpg, name, slot_seed);
+    }
+    if ((keygpg->attributes.value[0] == KEY_ID_ECDH) ||
+        (keygpg->attributes.value[0] == KEY_ID_ECDSA) ||
+        (keygpg->attributes.value[0] == KEY_ID_EDDSA)) {
+        return gpg_gen_ecc_kyey(keygpg, name, slot_seed);
+    }
+    return SWO_UNKNOWN;
+}
+
+/**
+ * Read a public key as a 7F49 template, then optionally store its
+ * fingerprint and date
+ * The template is built on first read, then copied from the heap cache
+ *
+ * @param[in]  keygpg pointer on key structure
+ * @param[in]  fpr_tag fingerprint DO tag (C7, C8, C9)
+ * @param[in]  date creation timestamp, big endian, NULL to only read the key
+ * @param[in]  v5 compute a v5 fingerprint, truncated to 20 bytes
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_gen_read_key(gpg_key_t *keygpg,
+                            unsigned int fpr_tag,
+                            const unsigned char *date,
+                            unsigned int v5) {
+    const unsigned char *cached = NULL;
+    unsigned int handle, l;
+    int sw = SWO_UNKNOWN;
+
+    handle = gpg_gen_pub_handle(keygpg);
+    l = gpg_heap_get(handle, &cached);
+    if (l != 0) {
+        gpg_io_discard(1);
+        gpg_io_insert(cached, l);
+        // value length, after the 7F49 tag
+        switch (cached[2]) {
+            case 0x81:
+                l = cached[3];
+                break;
+            case 0x82:
+                l = U2BE(cached, 3);
+                break;
+            default:
+                l = cached[2];
+                break;
+        }
+        sw = SWO_SUCCESS;
+    } else {
+        if (keygpg->attributes.value[0] == KEY_ID_RSA) {
+            sw = gpg_read_rsa_kyey(keygpg);
+        } else if ((keygpg->attributes.value[0] == KEY_ID_ECDH) ||
+                   (keygpg->attributes.value[0] == KEY_ID_ECDSA) ||
+                   (keygpg->attributes.value[0] == KEY_ID_EDDSA)) {
+            sw = gpg_read_ecc_kyey(keygpg);
+        }
+        l = G_gpg_vstate.io_length;
+        gpg_io_set_offset(IO_OFFSET_MARK);
+        gpg_io_insert_tl(0x7f49, l);
+        gpg_io_set_offset(IO_OFFSET_END);
+        if (sw == SWO_SUCCESS) {
+            // best effort: the template is rebuilt when the heap is full
+            gpg_heap_put(handle, G_gpg_vstate.work.io_buffer, G_gpg_vstate.io_length);
+        }
+    }
+    // --- store fingerprint and date ---
+    if ((sw == SWO_SUCCESS) && (date != NULL)) {
+        sw = gpg_gen_commit(keygpg,
+                            G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_length - l,
+                            l,
+                            fpr_tag,
+                            date,
+                            v5);
+    }
+    return sw;
+}
+
+/**
+ * Generate the three key pairs of a set of slots, from their seed
+ * Each slot seed is derived once for its three keys, and the signature
+ * counter is reset once per slot.
+ * The response gives the status of each key: slot, CRT tag, Status Word
+ *
+ * @param[in]  commit commit flags of P2 (COMMIT_MODE, COMMIT_V5_MODE)
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_gen_provision(unsigned int commit) {
+    static const unsigned char crts[3] = {KEY_SIG, KEY_DEC, KEY_AUT};
+    unsigned char status[GPG_KEYS_SLOTS * 3 * 4];
+    // BIP32 output, the slot seed is its first 32 bytes
+    unsigned char seed[66];
+    unsigned char date[4];
+    unsigned int mask, slot, k, n = 0, fpr_tag = 0, reset_cnt = 0;
+    gpg_key_slot_t *kslot = NULL;
+    gpg_key_t *keygpg = NULL;
+    uint8_t *name = NULL;
+    int sw = SWO_SUCCESS;
+
+    if (G_gpg_vstate.io_lc != (commit ? 5 : 1)) {
+        return SWO_WRONG_LENGTH;
+    }
+    mask = gpg_io_fetch_u8();
+    if (commit) {
+        gpg_io_fetch_buffer(date, 4);
+    }
+    if ((mask == 0) || ((mask >> GPG_KEYS_SLOTS) != 0)) {
+        return SWO_INCORRECT_DATA;
+    }
+
+    for (slot = 0; (slot < GPG_KEYS_SLOTS) && (sw == SWO_SUCCESS); slot++) {
+        if ((mask & (1 << slot)) == 0) {
+            continue;
+        }
+        kslot = gpg_install_slot_get(slot);
+        sw = gpg_pso_derive_slot_seed(slot, seed);
+        for (k = 0; k < 3; k++) {
+            if (sw == SWO_SUCCESS) {
+                keygpg = gpg_gen_get_key(kslot, crts[k], &name, &fpr_tag);
+                sw = gpg_gen_key_pair(keygpg, name, seed);
+            }
+            if ((sw == SWO_SUCCESS) && commit) {
+                gpg_io_discard(1);
+                sw = gpg_gen_read_key(keygpg, fpr_tag, date, commit & COMMIT_V5_MODE);
+            }
+            status[n++] = slot;
+            status[n++] = crts[k];
+            U2BE_ENCODE(status, n, sw);
+            n += 2;
+            if (sw != SWO_SUCCESS) {
+                break;
+            }
+        }
+        nvm_write(&kslot->sig_count, &reset_cnt, sizeof(unsigned int));
+    }
+    explicit_bzero(seed, sizeof(seed));
+
+    gpg_io_discard(1);
+    gpg_io_insert(status, n);
+    return SWO_SUCCESS;
+}
+
 /**
  * APDU handler to Generate/Read key pair
  *
@@ -343,80 +828,85 @@ end:
  *
  */
 int gpg_apdu_gen() {
-    uint32_t t, l;
+    uint32_t t, l, commit, reset_cnt = 0;
     gpg_key_t *keygpg = NULL;
     uint8_t *name = NULL;
+    unsigned int fpr_tag = 0;
+    unsigned char date[4];
+    // BIP32 output, the slot seed is its first 32 bytes
+    unsigned char seed[66];
     int sw = SWO_UNKNOWN;
 
-    switch (G_gpg_vstate.io_p1p2) {
+    // key pairs are built in the work area
+    gpg_io_taint();
+
+    commit = G_gpg_vstate.io_p2 & (COMMIT_MODE | COMMIT_V5_MODE);
+    switch (G_gpg_vstate.io_p1p2 & ~commit) {
         case GEN_ASYM_KEY:
         case GEN_ASYM_KEY_SEED:
-        case READ_ASYM_KEY:
+        case GEN_ASYM_KEY_PROVISION:
             break;
+        case READ_ASYM_KEY:
+            if (commit == 0) {
+                break;
+            }
+            __attribute__((fallthrough));
         default:
             return SWO_WRONG_P1_P2;
     }
+    if ((commit != 0) && ((commit & COMMIT_MODE) == 0)) {
+        return SWO_WRONG_P1_P2;
+    }
+
+    if ((G_gpg_vstate.io_p1p2 & ~commit) == GEN_ASYM_KEY_PROVISION) {
+        sw = gpg_gen_provision(commit);
+        if (sw == SWO_SUCCESS) {
+            gpg_state_counter_bump();
+        }
+        return sw;
+    }
 
-    if (G_gpg_vstate.io_lc != 2) {
+    if (G_gpg_vstate.io_lc != (commit ? 6 : 2)) {
         return SWO_WRONG_LENGTH;
     }
 
     gpg_io_fetch_tl(&t, &l);
-    gpg_io_discard(1);
-    switch (t) {
-        case KEY_SIG:
-            keygpg = &G_gpg_vstate.kslot->sig;
-            name = (unsigned char *) PIC("sig ");
-            break;
-        case KEY_AUT:
-            keygpg = &G_gpg_vstate.kslot->aut;
-            name = (unsigned char *) PIC("aut ");
-            break;
-        case KEY_DEC:
-            keygpg = &G_gpg_vstate.kslot->dec;
-            name = (unsigned char *) PIC("dec ");
-            break;
-        default:
-            break;
+    if (commit) {
+        gpg_io_fetch_buffer(date, 4);
     }
+    gpg_io_discard(1);
+    keygpg = gpg_gen_get_key(G_gpg_vstate.kslot, t, &name, &fpr_tag);
     if (keygpg == NULL) {
         return SWO_INCORRECT_DATA;
     }
 
-    switch (G_gpg_vstate.io_p1p2) {
+    switch (G_gpg_vstate.io_p1p2 & ~commit) {
         // -- generate keypair ---
         case GEN_ASYM_KEY:
         case GEN_ASYM_KEY_SEED:
-
-            if (keygpg->attributes.value[0] == KEY_ID_RSA) {
-                sw = gpg_gen_rsa_kyey(keygpg, name);
-                if (sw != SWO_SUCCESS) {
-                    break;
-                }
-            } else if ((keygpg->attributes.value[0] == KEY_ID_ECDH) ||
-                       (keygpg->attributes.value[0] == KEY_ID_ECDSA) ||
-                       (keygpg->attributes.value[0] == KEY_ID_EDDSA)) {
-                sw = gpg_gen_ecc_kyey(keygpg, name);
-                if (sw != SWO_SUCCESS) {
-                    break;
+            if ((G_gpg_vstate.io_p2 & SEEDED_MODE) || (G_gpg_vstate.seed_mode)) {
+                sw = gpg_pso_derive_slot_seed(G_gpg_vstate.slot, seed);
+                if (sw == SWO_SUCCESS) {
+                    sw = gpg_gen_key_pair(keygpg, name, seed);
                 }
+                explicit_bzero(seed, sizeof(seed));
+            } else {
+                sw = gpg_gen_key_pair(keygpg, name, NULL);
             }
+            if (sw != SWO_SUCCESS) {
+                break;
+            }
+            nvm_write(&G_gpg_vstate.kslot->sig_count, &reset_cnt, sizeof(unsigned int));
 
             __attribute__((fallthrough));
         // --- read pubkey ---
         case READ_ASYM_KEY:
-            if (keygpg->attributes.value[0] == KEY_ID_RSA) {
-                sw = gpg_read_rsa_kyey(keygpg);
-            } else if ((keygpg->attributes.value[0] == KEY_ID_ECDH) ||
-                       (keygpg->attributes.value[0] == KEY_ID_ECDSA) ||
-                       (keygpg->attributes.value[0] == KEY_ID_EDDSA)) {
-                sw = gpg_read_ecc_kyey(keygpg);
-            }
-            l = G_gpg_vstate.io_length;
-            gpg_io_set_offset(IO_OFFSET_MARK);
-            gpg_io_insert_tl(0x7f49, l);
-            gpg_io_set_offset(IO_OFFSET_END);
+            sw = gpg_gen_read_key(keygpg, fpr_tag, commit ? date : NULL, commit & COMMIT_V5_MODE);
             break;
     }
+    // reading the public key alone does not change the card state
+    if ((sw == SWO_SUCCESS) && (commit || ((G_gpg_vstate.io_p1p2 & ~commit) != READ_ASYM_KEY))) {
+        gpg_state_counter_bump();
+    }
     return sw;
 }
@@ -0,0 +1,385 @@
+/*****************************************************************************
+ *   Ledger App OpenPGP.
+ *   (c) 2024 Ledger SAS.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ *****************************************************************************/
+
+#include "gpg_vars.h"
+#include "os_utils.h"
+
+/*
+ * NVM heap: variable length DOs (certificates, private DOs, login data, URLs)
+ * are stored one after the other, with no hole, from the heap start up to
+ * heap_used. Removing an object moves the following ones down.
+ * A removal cut by a power loss is detected by gpg_heap_check: the objects
+ * following the removed one are then lost.
+ * Large objects (certificates) are streamed after the heap end and only
+ * become part of the heap once complete.
+ */
+
+/* objects are moved through RAM by chunks of this size */
+#define HEAP_MOVE_CHUNK 128
+
+/**
+ * Get the size of the object at an offset
+ *
+ * @param[in]  off object offset in the heap
+ * @param[in]  used heap used length
+ *
+ * @return object size, header included, 0 at the heap end or if the object
+ *         overruns it
+ *
+ */
+static unsigned int gpg_heap_size(unsigned int off, unsigned int used) {
+    const unsigned char *heap = (const unsigned char *) N_gpg_pstate->heap;
+    unsigned int size;
+
+    if ((used > GPG_NVM_HEAP_LENGTH) || (off + HEAP_HEADER_LENGTH > used)) {
+        return 0;
+    }
+    size = HEAP_HEADER_LENGTH + U2BE(heap, off + 4);
+    if (size > used - off) {
+        return 0;
+    }
+    return size;
+}
+
+/**
+ * Find an object in the heap
+ *
+ * @param[in]  handle object handle
+ * @param[out] offset object offset in the heap
+ *
+ * @return object size, header included, 0 if not found
+ *
+ */
+static unsigned int gpg_heap_find(unsigned int handle, unsigned int *offset) {
+    const unsigned char *heap = (const unsigned char *) N_gpg_pstate->heap;
+    unsigned int used = N_gpg_pstate->heap_used;
+    unsigned int off, size;
+
+    for (off = 0; (size = gpg_heap_size(off, used)) != 0; off += size) {
+        if (U4BE(heap, off) == handle) {
+            *offset = off;
+            return size;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Move a heap range down, through RAM
+ *
+ * @param[in]  to destination offset
+ * @param[in]  from source offset, above the destination
+ * @param[in]  len range length
+ *
+ */
+static void gpg_heap_move(unsigned int to, unsigned int from, unsigned int len) {
+    unsigned char chunk[HEAP_MOVE_CHUNK];
+    unsigned int n;
+
+    while (len != 0) {
+        n = MIN(sizeof(chunk), len);
+        memmove(chunk, (const void *) &N_gpg_pstate->heap[from], n);
+        nvm_write((void *) &N_gpg_pstate->heap[to], chunk, n);
+        to += n;
+        from += n;
+        len -= n;
+    }
+    explicit_bzero(chunk, sizeof(chunk));
+}
+
+/**
+ * Remove an object, the following ones are moved down and the freed
+ * space at the heap end is erased
+ *
+ * @param[in]  offset object offset in the heap
+ * @param[in]  size object size, header included
+ *
+ */
+static void gpg_heap_remove(unsigned int offset, unsigned int size) {
+    unsigned int used = N_gpg_pstate->heap_used;
+    unsigned int moving;
+
+    // flag the removal while the following objects are being moved
+    moving = offset + 1;
+    if (offset + size < used) {
+        nvm_write((void *) &N_gpg_pstate->heap_moving, &moving, sizeof(unsigned int));
+        gpg_heap_move(offset, offset + size, used - offset - size);
+    }
+    used -= size;
+    nvm_write((void *) &N_gpg_pstate->heap_used, &used, sizeof(unsigned int));
+    if (N_gpg_pstate->heap_moving != 0) {
+        nvm_write((void *) &N_gpg_pstate->heap_moving, NULL, sizeof(unsigned int));
+    }
+    nvm_write((void *) &N_gpg_pstate->heap[used], NULL, size);
+}
+
+/**
+ * Check the heap consistency, on application start
+ * After a removal cut by a power loss, only the objects before the removed
+ * one are kept. Otherwise, the heap is cut after the last valid object.
+ *
+ */
+void gpg_heap_check(void) {
+    unsigned int used = N_gpg_pstate->heap_used;
+    unsigned int off, size, end;
+
+    end = MIN(used, GPG_NVM_HEAP_LENGTH);
+    if (N_gpg_pstate->heap_moving != 0) {
+        used = MIN(N_gpg_pstate->heap_moving - 1, end);
+    }
+    for (off = 0; (size = gpg_heap_size(off, used)) != 0; off += size) {
+    }
+    if ((off == N_gpg_pstate->heap_used) && (N_gpg_pstate->heap_moving == 0)) {
+        return;
+    }
+    nvm_write((void *) &N_gpg_pstate->heap_used, &off, sizeof(unsigned int));
+    if (N_gpg_pstate->heap_moving != 0) {
+        nvm_write((void *) &N_gpg_pstate->heap_moving, NULL, sizeof(unsigned int));
+    }
+    if (end > off) {
+        nvm_write((void *) &N_gpg_pstate->heap[off], NULL, end - off);
+    }
+}
+
+/**
+ * Remove all the cache objects
+ *
+ * @return freed size
+ *
+ */
+static unsigned int gpg_heap_drop_cache(void) {
+    const unsigned char *heap = (const unsigned char *) N_gpg_pstate->heap;
+    unsigned int off, size, freed = 0;
+
+    off = 0;
+    while ((size = gpg_heap_size(off, N_gpg_pstate->heap_used)) != 0) {
+        if (HEAP_HANDLE_TAG(U4BE(heap, off)) == HEAP_CACHE_TAG) {
+            gpg_heap_remove(off, size);
+            freed += size;
+        } else {
+            off += size;
+        }
+    }
+    return freed;
+}
+
+/**
+ * Get the room available for new objects, cache objects being evictable
+ *
+ * @return available size
+ *
+ */
+unsigned int gpg_heap_available(void) {
+    const unsigned char *heap = (const unsigned char *) N_gpg_pstate->heap;
+    unsigned int off, size, room;
+
+    if (N_gpg_pstate->heap_used > GPG_NVM_HEAP_LENGTH) {
+        return 0;
+    }
+    room = GPG_NVM_HEAP_LENGTH - N_gpg_pstate->heap_used;
+    for (off = 0; (size = gpg_heap_size(off, N_gpg_pstate->heap_used)) != 0; off += size) {
+        if (HEAP_HANDLE_TAG(U4BE(heap, off)) == HEAP_CACHE_TAG) {
+            room += size;
+        }
+    }
+    return room;
+}
+
+/**
+ * Get an object value
+ *
+ * @param[in]  handle object handle
+ * @param[out] value object value, in NVM
+ *
+ * @return value length, 0 if not found
+ *
+ */
+unsigned int gpg_heap_get(unsigned int handle, const unsigned char **value) {
+    unsigned int offset = 0;
+    unsigned int size;
+
+    size = gpg_heap_find(handle, &offset);
+    *value = (const unsigned char *) &N_gpg_pstate->heap[offset + HEAP_HEADER_LENGTH];
+    if (size == 0) {
+        return 0;
+    }
+    return size - HEAP_HEADER_LENGTH;
+}
+
+/**
+ * Set an object value, an empty value removes the object
+ * Cache objects are evicted when room is missing for another object
+ * On error, the previous value is kept
+ *
+ * @param[in]  handle object handle
+ * @param[in]  value new value
+ * @param[in]  len value length
+ *
+ * @return Status Word
+ *
+ */
+int gpg_heap_put(unsigned int handle, const unsigned char *value, unsigned int len) {
+    unsigned char hdr[HEAP_HEADER_LENGTH];
+    unsigned int offset = 0;
+    unsigned int size, used;
+
+    if (len > 0xFFFF) {
+        return SWO_WRONG_LENGTH;
+    }
+    if (N_gpg_pstate->heap_used > GPG_NVM_HEAP_LENGTH) {
+        return SWO_NOT_ENOUGH_MEMORY_SPACE;
+    }
+    size = gpg_heap_find(handle, &offset);
+    // same length: update in place
+    if ((len != 0) && (size == HEAP_HEADER_LENGTH + len)) {
+        nvm_write((void *) &N_gpg_pstate->heap[offset + HEAP_HEADER_LENGTH], (void *) value, len);
+        return SWO_SUCCESS;
+    }
+    used = N_gpg_pstate->heap_used - size;
+    if ((len != 0) && (HEAP_HEADER_LENGTH + len > GPG_NVM_HEAP_LENGTH - used)) {
+        if ((HEAP_HANDLE_TAG(handle) != HEAP_CACHE_TAG) && (gpg_heap_drop_cache() != 0)) {
+            return gpg_heap_put(handle, value, len);
+        }
+        return SWO_NOT_ENOUGH_MEMORY_SPACE;
+    }
+    if (size != 0) {
+        gpg_heap_remove(offset, size);
+    }
+    if (len == 0) {
+        return SWO_SUCCESS;
+    }
+    U4BE_ENCODE(hdr, 0, handle);
+    U2BE_ENCODE(hdr, 4, len);
+    nvm_write((void *) &N_gpg_pstate->heap[used], hdr, HEAP_HEADER_LENGTH);
+    nvm_write((void *) &N_gpg_pstate->heap[used + HEAP_HEADER_LENGTH], (void *) value, len);
+    used += HEAP_HEADER_LENGTH + len;
+    nvm_write((void *) &N_gpg_pstate->heap_used, &used, sizeof(unsigned int));
+    return SWO_SUCCESS;
+}
+
+/**
+ * Remove all the objects bound to a key slot
+ *
+ * @param[in]  slot key slot index
+ *
+ */
+void gpg_heap_drop_slot(unsigned int slot) {
+    const unsigned char *heap = (const unsigned char *) N_gpg_pstate->heap;
+    unsigned int off, size;
+
+    off = 0;
+    while ((size = gpg_heap_size(off, N_gpg_pstate->heap_used)) != 0) {
+        if (HEAP_HANDLE_SLOT(U4BE(heap, off)) == slot) {
+            gpg_heap_remove(off, size);
+        } else {
+            off += size;
+        }
+    }
+}
+
+/**
+ * Start a streamed object write
+ * The value is received chunk by chunk and written after the heap end,
+ * out of the heap until gpg_heap_stream_commit. The previous value is kept
+ * until then, so room is needed for both.
+ *
+ * @param[in]  handle object handle
+ * @param[in]  max maximum value length
+ *
+ */
+void gpg_heap_stream_start(unsigned int handle, unsigned int max) {
+    explicit_bzero(&G_gpg_vstate.heap_stream, sizeof(G_gpg_vstate.heap_stream));
+    G_gpg_vstate.heap_stream.handle = handle;
+    G_gpg_vstate.heap_stream.max = MIN(max, 0xFFFF);
+    G_gpg_vstate.heap_stream.sw = SWO_SUCCESS;
+    if (N_gpg_pstate->heap_used > GPG_NVM_HEAP_LENGTH) {
+        G_gpg_vstate.heap_stream.sw = SWO_NOT_ENOUGH_MEMORY_SPACE;
+    }
+}
+
+/**
+ * Append a chunk to a streamed object write
+ * Cache objects are evicted when room is missing, the received part is
+ * then moved down to follow the new heap end
+ *
+ * @param[in]  chunk received data
+ * @param[in]  len chunk length
+ *
+ */
+void gpg_heap_stream_chunk(const unsigned char *chunk, unsigned int len) {
+    unsigned int length = G_gpg_vstate.heap_stream.length;
+    unsigned int from = N_gpg_pstate->heap_used;
+
+    if ((G_gpg_vstate.heap_stream.sw != SWO_SUCCESS) || (len == 0)) {
+        return;
+    }
+    if (length + len > G_gpg_vstate.heap_stream.max) {
+        G_gpg_vstate.heap_stream.sw = SWO_WRONG_LENGTH;
+        return;
+    }
+    if ((from + HEAP_HEADER_LENGTH + length + len > GPG_NVM_HEAP_LENGTH) &&
+        (HEAP_HANDLE_TAG(G_gpg_vstate.heap_stream.handle) != HEAP_CACHE_TAG) &&
+        (gpg_heap_drop_cache() != 0)) {
+        gpg_heap_move(N_gpg_pstate->heap_used + HEAP_HEADER_LENGTH,
+                      from + HEAP_HEADER_LENGTH,
+                      length);
+    }
+    from = N_gpg_pstate->heap_used + HEAP_HEADER_LENGTH + length;
+    if (from + len > GPG_NVM_HEAP_LENGTH) {
+        G_gpg_vstate.heap_stream.sw = SWO_NOT_ENOUGH_MEMORY_SPACE;
+        return;
+    }
+    nvm_write((void *) &N_gpg_pstate->heap[from], (void *) chunk, len);
+    G_gpg_vstate.heap_stream.length = length + len;
+}
+
+/**
+ * Complete a streamed object write: the previous value is removed and the
+ * received one becomes the last heap object. An empty value removes the
+ * object.
+ *
+ * @return Status Word
+ *
+ */
+int gpg_heap_stream_commit(void) {
+    unsigned char hdr[HEAP_HEADER_LENGTH];
+    unsigned int handle = G_gpg_vstate.heap_stream.handle;
+    unsigned int len = G_gpg_vstate.heap_stream.length;
+    unsigned int offset = 0;
+    unsigned int size, used;
+
+    if (G_gpg_vstate.heap_stream.sw != SWO_SUCCESS) {
+        return G_gpg_vstate.heap_stream.sw;
+    }
+    if (len == 0) {
+        return gpg_heap_put(handle, NULL, 0);
+    }
+    used = N_gpg_pstate->heap_used;
+    size = gpg_heap_find(handle, &offset);
+    if (size != 0) {
+        // the received value lies after the heap end, out of the moved range
+        gpg_heap_remove(offset, size);
+        gpg_heap_move(used - size + HEAP_HEADER_LENGTH, used + HEAP_HEADER_LENGTH, len);
+        used -= size;
+    }
+    U4BE_ENCODE(hdr, 0, handle);
+    U2BE_ENCODE(hdr, 4, len);
+    nvm_write((void *) &N_gpg_pstate->heap[used], hdr, HEAP_HEADER_LENGTH);
+    used += HEAP_HEADER_LENGTH + len;
+    nvm_write((void *) &N_gpg_pstate->heap_used, &used, sizeof(unsigned int));
+    return SWO_SUCCESS;
+}
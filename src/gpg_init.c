@@ -19,6 +19,8 @@
 #include "ccid_cmd.h"
 #include "ox_ec.h"
 
+static void gpg_install_first(void);
+
 #define SHORT(x) ((x) >> 8) & 0xFF, (x) &0xFF
 /* ----------------------*/
 /* -- A Kind of Magic -- */
@@ -375,14 +377,23 @@ void gpg_init() {
     explicit_bzero(&G_gpg_vstate, sizeof(gpg_v_state_t));
     // first init ?
     if (memcmp((void *) (N_gpg_pstate->magic), (void *) C_MAGIC, MAGIC_LENGTH) != 0) {
+        gpg_install_first();
         gpg_install(STATE_ACTIVATE);
         nvm_write((void *) (N_gpg_pstate->magic), (void *) C_MAGIC, MAGIC_LENGTH);
         explicit_bzero(&G_gpg_vstate, sizeof(gpg_v_state_t));
     }
+    // an archive restore has been interrupted
+    if (N_gpg_pstate->restore_pending) {
+        gpg_install_restore_failed();
+        explicit_bzero(&G_gpg_vstate, sizeof(gpg_v_state_t));
+    }
+    gpg_heap_check();
+    // a bulk put has been interrupted
+    gpg_data_bulk_replay();
 
     // key conf
     G_gpg_vstate.slot = N_gpg_pstate->config_slot[1];
-    G_gpg_vstate.kslot = (gpg_key_slot_t *) &N_gpg_pstate->keys[G_gpg_vstate.slot];
+    G_gpg_vstate.kslot = gpg_install_slot_get(G_gpg_vstate.slot);
     gpg_mse_reset();
     // pin conf
     G_gpg_vstate.pinmode = N_gpg_pstate->config_pin[0];
@@ -391,42 +402,171 @@ void gpg_init() {
     // ux conf
     G_gpg_vstate.ux_type = -1;
     G_gpg_vstate.ux_key = -1;
+
+    // RAM budget report, each part running up to the next one
+    PRINTF("[INIT] - vstate=%d app+io=%d work=%d data+streams=%d drbg=%d aes_stream=%d ecdh=%d "
+           "pin+ux=%d\n",
+           (int) sizeof(gpg_v_state_t),
+           (int) offsetof(gpg_v_state_t, work),
+           (int) sizeof(G_gpg_vstate.work),
+           (int) (offsetof(gpg_v_state_t, drbg) - offsetof(gpg_v_state_t, DO_current)),
+           (int) (offsetof(gpg_v_state_t, aes_stream) - offsetof(gpg_v_state_t, drbg)),
+           (int) (offsetof(gpg_v_state_t, ecdh_cache) - offsetof(gpg_v_state_t, aes_stream)),
+           (int) (offsetof(gpg_v_state_t, verified_pin) - offsetof(gpg_v_state_t, ecdh_cache)),
+           (int) (sizeof(gpg_v_state_t) - offsetof(gpg_v_state_t, verified_pin)));
 }
 
 /* ----------------------------------------------------------------------- */
 /* ---  Install/ReInstall GPGapp                                       --- */
 /* ----------------------------------------------------------------------- */
 
+/**
+ * Erase an NVM area, up to its last non zero byte only
+ *
+ * @param[in]  ptr NVM area
+ * @param[in]  len area length
+ *
+ */
+static void gpg_nvm_erase(void *ptr, unsigned int len) {
+    const unsigned char *p = (const unsigned char *) ptr;
+
+    while ((len != 0) && (p[len - 1] == 0)) {
+        len--;
+    }
+    if (len != 0) {
+        nvm_write(ptr, NULL, len);
+    }
+}
+
+/**
+ * Write an NVM area, only if its content changes
+ *
+ * @param[in]  ptr NVM area
+ * @param[in]  value new content
+ * @param[in]  len area length
+ *
+ */
+static void gpg_nvm_update(void *ptr, const void *value, unsigned int len) {
+    if (memcmp(ptr, value, len) != 0) {
+        nvm_write(ptr, (void *) value, len);
+    }
+}
+
+/**
+ * Bump the card state counter (DO 01FD)
+ * Called after each change of the data read by the host
+ *
+ */
+void gpg_state_counter_bump(void) {
+    unsigned int cnt;
+
+    cnt = N_gpg_pstate->state_counter + 1;
+    nvm_write((void *) &N_gpg_pstate->state_counter, &cnt, sizeof(unsigned int));
+}
+
+/**
+ * Invalidate a key: key material, fingerprint and generation date are
+ * erased, attributes, UIF, CA fingerprint and certificate are kept
+ *
+ * @param[in]  keygpg key to invalidate
+ *
+ */
+void gpg_install_key_invalidate(gpg_key_t *keygpg) {
+    gpg_gen_pub_invalidate(keygpg);
+    gpg_nvm_erase(&keygpg->priv_key, sizeof(keygpg->priv_key));
+    gpg_nvm_erase(&keygpg->pub_key, sizeof(keygpg->pub_key));
+    gpg_nvm_erase(keygpg->fingerprints, sizeof(keygpg->fingerprints));
+    gpg_nvm_erase(keygpg->date, sizeof(keygpg->date));
+}
+
+/**
+ * Key default config
+ *
+ * @param[in]  keygpg key to configure
+ * @param[in]  attributes default attributes
+ * @param[in]  len attributes length
+ *
+ */
+static void gpg_install_key(gpg_key_t *keygpg, const unsigned char *attributes, unsigned int len) {
+    LV(attr, GPG_KEY_ATTRIBUTES_LENGTH);
+    unsigned char uif[2];
+
+    gpg_install_key_invalidate(keygpg);
+    gpg_nvm_erase(keygpg->CA_fingerprints, sizeof(keygpg->CA_fingerprints));
+
+    memset(&attr, 0, sizeof(attr));
+    attr.length = len;
+    memmove(attr.value, attributes, len);
+    gpg_nvm_update(&keygpg->attributes, &attr, sizeof(attr));
+
+    uif[0] = 0x00;
+    uif[1] = C_gen_feature;
+    gpg_nvm_update(keygpg->UIF, uif, 2);
+}
+
 /**
  * App dedicated slot config
+ * Only the NVM areas not already in their default state are written
  *
  * @param[in]  slot Selected slot to configure
  *
  */
 void gpg_install_slot(gpg_key_slot_t *slot) {
     unsigned char tmp[4];
-    unsigned int l;
 
-    nvm_write(slot, 0, sizeof(gpg_key_slot_t));
+    gpg_heap_drop_slot(slot - (gpg_key_slot_t *) N_gpg_pstate->keys);
 
     cx_rng(tmp, 4);
     nvm_write((void *) (slot->serial), tmp, 4);
 
-    l = sizeof(C_default_AlgoAttr_sig);
-    nvm_write((void *) (&slot->sig.attributes.value), (void *) C_default_AlgoAttr_sig, l);
-    nvm_write((void *) (&slot->sig.attributes.length), &l, sizeof(unsigned int));
-    nvm_write((void *) (&slot->aut.attributes.value), (void *) C_default_AlgoAttr_sig, l);
-    nvm_write((void *) (&slot->aut.attributes.length), &l, sizeof(unsigned int));
-
-    l = sizeof(C_default_AlgoAttr_dec);
-    nvm_write((void *) (&slot->dec.attributes.value), (void *) C_default_AlgoAttr_dec, l);
-    nvm_write((void *) (&slot->dec.attributes.length), &l, sizeof(unsigned int));
-
-    tmp[0] = 0x00;
-    tmp[1] = C_gen_feature;
-    nvm_write((void *) (&slot->sig.UIF), &tmp, 2);
-    nvm_write((void *) (&slot->dec.UIF), &tmp, 2);
-    nvm_write((void *) (&slot->aut.UIF), &tmp, 2);
+    gpg_install_key(&slot->sig, C_default_AlgoAttr_sig, sizeof(C_default_AlgoAttr_sig));
+    gpg_install_key(&slot->aut, C_default_AlgoAttr_sig, sizeof(C_default_AlgoAttr_sig));
+    gpg_install_key(&slot->dec, C_default_AlgoAttr_dec, sizeof(C_default_AlgoAttr_dec));
+
+    gpg_nvm_erase(&slot->sig_count, sizeof(slot->sig_count));
+    gpg_nvm_erase(&slot->AES_dec, sizeof(slot->AES_dec));
+
+    // the slot is valid once its generation is up to date
+    gpg_nvm_update(&slot->generation,
+                   (const void *) &N_gpg_pstate->generation,
+                   sizeof(unsigned int));
+}
+
+/**
+ * Get a key slot, it is reinstalled first if a reset occurred since its
+ * last installation
+ *
+ * @param[in]  slot key slot index
+ *
+ * @return key slot
+ *
+ */
+gpg_key_slot_t *gpg_install_slot_get(unsigned int slot) {
+    gpg_key_slot_t *kslot = (gpg_key_slot_t *) &N_gpg_pstate->keys[slot];
+
+    if (kslot->generation != N_gpg_pstate->generation) {
+        gpg_install_slot(kslot);
+    }
+    return kslot;
+}
+
+/**
+ * App 1st installation, with an unknown NVM content
+ * The whole DO heap is erased and all key slots are marked as not installed,
+ * global data are then set by gpg_install and slots on their first selection
+ *
+ */
+static void gpg_install_first(void) {
+    gpg_nvm_erase((void *) N_gpg_pstate->heap, GPG_NVM_HEAP_LENGTH);
+    gpg_nvm_erase((void *) &N_gpg_pstate->heap_used, sizeof(unsigned int));
+    gpg_nvm_erase((void *) &N_gpg_pstate->heap_moving, sizeof(unsigned int));
+    for (int s = 0; s < GPG_KEYS_SLOTS; s++) {
+        gpg_nvm_erase((void *) &N_gpg_pstate->keys[s].generation, sizeof(unsigned int));
+    }
+    gpg_nvm_erase((void *) &N_gpg_pstate->generation, sizeof(unsigned int));
+    gpg_nvm_erase((void *) &N_gpg_pstate->state_counter, sizeof(unsigned int));
+    gpg_nvm_erase((void *) &N_gpg_pstate->restore_pending, sizeof(unsigned int));
+    gpg_nvm_erase((void *) &N_gpg_pstate->bulk.pending, sizeof(unsigned int));
 }
 
 /**
@@ -437,9 +577,29 @@ void gpg_install_slot(gpg_key_slot_t *slot) {
  */
 void gpg_install(unsigned char app_state) {
     gpg_pin_t pin;
-
-    // full reset data
-    nvm_write((void *) (N_gpg_pstate), NULL, sizeof(gpg_nv_state_t));
+    gpg_key_slot_t *kslot;
+    unsigned int gen;
+
+    // reset global data, key slots settings are reinstalled on their next use
+    gpg_nvm_erase((void *) &N_gpg_pstate->config_pin,
+                  offsetof(gpg_nv_state_t, keys) - offsetof(gpg_nv_state_t, config_pin));
+    gpg_nvm_erase((void *) &N_gpg_pstate->SM_enc,
+                  offsetof(gpg_nv_state_t, generation) - offsetof(gpg_nv_state_t, SM_enc));
+    gpg_nvm_erase((void *) N_gpg_pstate->heap, MIN(N_gpg_pstate->heap_used, GPG_NVM_HEAP_LENGTH));
+    gpg_nvm_erase((void *) &N_gpg_pstate->heap_used, sizeof(unsigned int));
+    gpg_nvm_erase((void *) &N_gpg_pstate->heap_moving, sizeof(unsigned int));
+    // key material of all slots is erased now: stale slots are part of the archive
+    for (int s = 0; s < GPG_KEYS_SLOTS; s++) {
+        kslot = (gpg_key_slot_t *) &N_gpg_pstate->keys[s];
+        gpg_install_key_invalidate(&kslot->sig);
+        gpg_install_key_invalidate(&kslot->dec);
+        gpg_install_key_invalidate(&kslot->aut);
+        gpg_nvm_erase(&kslot->AES_dec, sizeof(kslot->AES_dec));
+    }
+    gen = N_gpg_pstate->generation + 1;
+    nvm_write((void *) &N_gpg_pstate->generation, &gen, sizeof(unsigned int));
+    gpg_state_counter_bump();
+    gpg_io_taint();
 
     // historical bytes
     memmove(G_gpg_vstate.work.io_buffer, C_default_Histo, HISTO_LENGTH);
@@ -491,13 +651,25 @@ void gpg_install(unsigned char app_state) {
         nvm_write((void *) (&N_gpg_pstate->config_pin), G_gpg_vstate.work.io_buffer, 1);
         gpg_activate_pinpad(3);
 
-        // default key template
-        for (int s = 0; s < GPG_KEYS_SLOTS; s++) {
-            gpg_install_slot((gpg_key_slot_t *) &N_gpg_pstate->keys[s]);
-        }
+        // default key template of the current slot, the other ones follow on use
+        G_gpg_vstate.kslot = gpg_install_slot_get(G_gpg_vstate.slot);
     }
 }
 
+/**
+ * Reset the application after a partially applied archive restore
+ * Config, keys and DOs are in an unknown mix of the previous and restored
+ * states, so the whole application is reinstalled, PINs included
+ *
+ */
+void gpg_install_restore_failed(void) {
+    unsigned int pending = 0;
+
+    gpg_install(STATE_ACTIVATE);
+    nvm_write((void *) &N_gpg_pstate->restore_pending, &pending, sizeof(unsigned int));
+    explicit_bzero(G_gpg_vstate.verified_pin, sizeof(G_gpg_vstate.verified_pin));
+}
+
 /**
  * Setup pinpad configuration
  *
@@ -24,6 +24,8 @@
  * io_buffer: contains current message part
  * io_offset: offset in current message part
  * io_length: length of current message part
+ * io_nvm:    NVM range of the response, sent at io_nvm_at without being
+ *            copied in io_buffer
  */
 
 /* ----------------------------------------------------------------------- */
@@ -59,6 +61,28 @@ void gpg_io_mark() {
     G_gpg_vstate.io_mark = G_gpg_vstate.io_offset;
 }
 
+/**
+ * Extend the written extent of the APDU buffer to the current length
+ *
+ */
+static void gpg_io_dirty() {
+    LEDGER_ASSERT((G_gpg_vstate.io_length + G_gpg_vstate.scratch_used) <= GPG_IO_BUFFER_LENGTH,
+                  "I/O over scratch!");
+    if (G_gpg_vstate.io_length > G_gpg_vstate.io_dirty) {
+        G_gpg_vstate.io_dirty = G_gpg_vstate.io_length;
+    }
+}
+
+/**
+ * Mark the whole APDU buffer as written
+ * Used when the work area holds key material or scratch data outside of
+ * the message, so that the next clear wipes it entirely
+ *
+ */
+void gpg_io_taint() {
+    G_gpg_vstate.io_dirty = GPG_IO_BUFFER_LENGTH;
+}
+
 /**
  * Shift empty space in APDU buffer
  *
@@ -68,6 +92,7 @@ void gpg_io_mark() {
 void gpg_io_inserted(unsigned int len) {
     G_gpg_vstate.io_offset += len;
     G_gpg_vstate.io_length += len;
+    gpg_io_dirty();
 }
 
 /**
@@ -81,6 +106,7 @@ void gpg_io_discard(int clear) {
     G_gpg_vstate.io_length = 0;
     G_gpg_vstate.io_offset = 0;
     G_gpg_vstate.io_mark = 0;
+    G_gpg_vstate.io_nvm_length = 0;
     if (clear) {
         gpg_io_clear();
     }
@@ -88,10 +114,66 @@ void gpg_io_discard(int clear) {
 
 /**
  * Clear (zeroed) the APDU buffer
+ * Only the extent written since the last clear is wiped
  *
  */
 void gpg_io_clear() {
-    explicit_bzero(G_gpg_vstate.work.io_buffer, GPG_IO_BUFFER_LENGTH);
+    explicit_bzero(G_gpg_vstate.work.io_buffer, G_gpg_vstate.io_dirty);
+    G_gpg_vstate.io_dirty = 0;
+}
+
+/* ----------------------------------------------------------------------- */
+/* SCRATCH arena                                                           */
+/* ----------------------------------------------------------------------- */
+
+/*
+ * Scratch areas are stacked from the end of io_buffer, while the message
+ * grows from its start: hashing or key derivation may then run while the
+ * input data stays in place. Both sides assert they never overlap.
+ */
+
+#define SCRATCH_ALIGN 8
+
+_Static_assert((GPG_IO_BUFFER_LENGTH % SCRATCH_ALIGN) == 0, "Unaligned scratch arena");
+
+/**
+ * Get the scratch arena level, to give back to gpg_io_scratch_release
+ *
+ * @return current level
+ *
+ */
+unsigned int gpg_io_scratch_mark() {
+    return G_gpg_vstate.scratch_used;
+}
+
+/**
+ * Allocate a scratch area at the end of the APDU buffer
+ *
+ * @param[in]  len area length
+ *
+ * @return area address
+ *
+ */
+void *gpg_io_scratch_alloc(unsigned int len) {
+    len = (len + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1);
+    LEDGER_ASSERT(
+        (G_gpg_vstate.io_length + G_gpg_vstate.scratch_used + len) <= GPG_IO_BUFFER_LENGTH,
+        "Scratch over I/O!");
+    G_gpg_vstate.scratch_used += len;
+    return G_gpg_vstate.work.io_buffer + GPG_IO_BUFFER_LENGTH - G_gpg_vstate.scratch_used;
+}
+
+/**
+ * Release, and wipe, the scratch areas allocated since a mark
+ *
+ * @param[in]  mark level returned by gpg_io_scratch_mark
+ *
+ */
+void gpg_io_scratch_release(unsigned int mark) {
+    LEDGER_ASSERT(mark <= G_gpg_vstate.scratch_used, "Bad scratch mark!");
+    explicit_bzero(G_gpg_vstate.work.io_buffer + GPG_IO_BUFFER_LENGTH - G_gpg_vstate.scratch_used,
+                   G_gpg_vstate.scratch_used - mark);
+    G_gpg_vstate.scratch_used = mark;
 }
 
 /* ----------------------------------------------------------------------- */
@@ -111,6 +193,11 @@ static void gpg_io_hole(unsigned int sz) {
             G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
             G_gpg_vstate.io_length - G_gpg_vstate.io_offset);
     G_gpg_vstate.io_length += sz;
+    // data inserted at the NVM range position goes after it
+    if ((G_gpg_vstate.io_nvm_length != 0) && (G_gpg_vstate.io_offset < G_gpg_vstate.io_nvm_at)) {
+        G_gpg_vstate.io_nvm_at += sz;
+    }
+    gpg_io_dirty();
 }
 
 /**
@@ -126,6 +213,69 @@ void gpg_io_insert(unsigned char const *buff, unsigned int len) {
     G_gpg_vstate.io_offset += len;
 }
 
+/**
+ * Insert an NVM range into the response, without copying it
+ * The range is read when the response is sent: it shall not be modified
+ * before. Only one range can be inserted per response.
+ *
+ * @param[in]  value NVM data
+ * @param[in]  len data length
+ *
+ */
+void gpg_io_insert_nvm(unsigned char const *value, unsigned int len) {
+    if (len == 0) {
+        return;
+    }
+    LEDGER_ASSERT(G_gpg_vstate.io_nvm_length == 0, "NVM range already inserted!");
+    LEDGER_ASSERT(len <= 0xFFFF, "Bad NVM range!");
+    G_gpg_vstate.io_nvm = value;
+    G_gpg_vstate.io_nvm_at = G_gpg_vstate.io_offset;
+    G_gpg_vstate.io_nvm_length = len;
+}
+
+/**
+ * Keep only a part of the response, NVM range included
+ *
+ * @param[in]  off part offset in the response
+ * @param[in]  len part length
+ *
+ */
+void gpg_io_slice(unsigned int off, unsigned int len) {
+    unsigned int at = G_gpg_vstate.io_nvm_at;
+    unsigned int nvm_len = G_gpg_vstate.io_nvm_length;
+    unsigned int head, skip, tail;
+
+    LEDGER_ASSERT((off + len) <= (G_gpg_vstate.io_length + nvm_len), "Bad slice!");
+    if ((nvm_len == 0) || ((off + len) <= at)) {
+        // before the NVM range
+        memmove(G_gpg_vstate.work.io_buffer, G_gpg_vstate.work.io_buffer + off, len);
+        nvm_len = 0;
+        head = len;
+    } else if (off >= (at + nvm_len)) {
+        // after the NVM range
+        memmove(G_gpg_vstate.work.io_buffer, G_gpg_vstate.work.io_buffer + off - nvm_len, len);
+        nvm_len = 0;
+        head = len;
+    } else {
+        // across the NVM range
+        head = (off < at) ? (at - off) : 0;
+        skip = (off > at) ? (off - at) : 0;
+        memmove(G_gpg_vstate.work.io_buffer, G_gpg_vstate.work.io_buffer + off, head);
+        nvm_len -= skip;
+        if (nvm_len > len - head) {
+            nvm_len = len - head;
+        }
+        tail = len - head - nvm_len;
+        memmove(G_gpg_vstate.work.io_buffer + head, G_gpg_vstate.work.io_buffer + at, tail);
+        G_gpg_vstate.io_nvm += skip;
+        G_gpg_vstate.io_nvm_at = head;
+        head += tail;
+    }
+    G_gpg_vstate.io_nvm_length = nvm_len;
+    G_gpg_vstate.io_length = head;
+    G_gpg_vstate.io_offset = head;
+}
+
 /**
  * Insert a u32 value into the APDU buffer
  *
@@ -388,6 +538,73 @@ int gpg_io_fetch(unsigned char *buffer, int len) {
 
 #define MAX_OUT GPG_APDU_LENGTH
 
+/**
+ * Copy the next response bytes to the APDU buffer
+ * The NVM range is read in place, between the io_buffer parts
+ *
+ * @param[in]  len number of bytes to copy
+ *
+ */
+static void gpg_io_gather(unsigned int len) {
+    unsigned int tx = 0, sz;
+
+    if (G_gpg_vstate.io_nvm_length != 0) {
+        sz = G_gpg_vstate.io_nvm_at - G_gpg_vstate.io_offset;
+        if (sz > len) {
+            sz = len;
+        }
+        memmove(G_io_apdu_buffer, G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset, sz);
+        G_gpg_vstate.io_offset += sz;
+        G_gpg_vstate.io_length -= sz;
+        tx = sz;
+        sz = len - tx;
+        if (sz > G_gpg_vstate.io_nvm_length) {
+            sz = G_gpg_vstate.io_nvm_length;
+        }
+        memmove(G_io_apdu_buffer + tx, G_gpg_vstate.io_nvm, sz);
+        G_gpg_vstate.io_nvm += sz;
+        G_gpg_vstate.io_nvm_length -= sz;
+        tx += sz;
+    }
+    memmove(G_io_apdu_buffer + tx,
+            G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
+            len - tx);
+    G_gpg_vstate.io_offset += len - tx;
+    G_gpg_vstate.io_length -= len - tx;
+}
+
+/**
+ * Append streamed response data
+ * Pending bytes are moved at the buffer start, and the status word
+ * is kept at the end of the response
+ *
+ */
+static void gpg_io_stream_refill(void) {
+    unsigned int sw;
+    int rc;
+
+    LEDGER_ASSERT((G_gpg_vstate.io_length >= 2) && (G_gpg_vstate.io_nvm_length == 0),
+                  "Bad stream!");
+    memmove(G_gpg_vstate.work.io_buffer,
+            G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
+            G_gpg_vstate.io_length);
+    G_gpg_vstate.io_length -= 2;
+    sw = U2BE(G_gpg_vstate.work.io_buffer, G_gpg_vstate.io_length);
+    while (G_gpg_vstate.io_stream_out && (G_gpg_vstate.io_length < MAX_OUT)) {
+        gpg_io_set_offset(IO_OFFSET_END);
+        rc = gpg_data_stream_next();
+        if (rc != SWO_RESPONSE_BYTES_AVAILABLE) {
+            G_gpg_vstate.io_stream_out = 0;
+            if (rc != SWO_SUCCESS) {
+                sw = rc;
+            }
+        }
+    }
+    gpg_io_set_offset(IO_OFFSET_END);
+    gpg_io_insert_u16(sw);
+    G_gpg_vstate.io_offset = 0;
+}
+
 /**
  * APDU Receive/transmit
  *
@@ -395,7 +612,7 @@ int gpg_io_fetch(unsigned char *buffer, int len) {
  *
  */
 void gpg_io_do(unsigned int io_flags) {
-    unsigned int rx = 0;
+    unsigned int rx = 0, tx;
 
     // if pending input chaining
     if (G_gpg_vstate.io_cla & CLA_APP_CHAIN) {
@@ -409,18 +626,24 @@ void gpg_io_do(unsigned int io_flags) {
     } else {
         // --- full out chaining ---
         G_gpg_vstate.io_offset = 0;
-        while (G_gpg_vstate.io_length > MAX_OUT) {
-            unsigned int tx, xx;
+        for (;;) {
+            unsigned int xx;
+            if (G_gpg_vstate.io_stream_out) {
+                gpg_io_stream_refill();
+            }
+            xx = G_gpg_vstate.io_length + G_gpg_vstate.io_nvm_length;
+            if (xx <= MAX_OUT) {
+                break;
+            }
             // send chunk
             tx = MAX_OUT - 2;
-            memmove(G_io_apdu_buffer, G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset, tx);
-            G_gpg_vstate.io_length -= tx;
-            G_gpg_vstate.io_offset += tx;
+            gpg_io_gather(tx);
+            xx -= tx;
             G_io_apdu_buffer[tx] = (SWO_RESPONSE_BYTES_AVAILABLE >> 8) & 0xFF;
-            if (G_gpg_vstate.io_length > MAX_OUT - 2) {
+            if ((xx > MAX_OUT - 2) || G_gpg_vstate.io_stream_out) {
                 xx = MAX_OUT - 2;
             } else {
-                xx = G_gpg_vstate.io_length - 2;
+                xx = xx - 2;
             }
             G_io_apdu_buffer[tx + 1] = xx;
             io_exchange(CHANNEL_APDU, tx + 2);
@@ -429,18 +652,21 @@ void gpg_io_do(unsigned int io_flags) {
                 (G_io_apdu_buffer[OFFSET_INS] != INS_GET_RESPONSE) ||
                 (G_io_apdu_buffer[OFFSET_P1] != GET_RESPONSE) ||
                 (G_io_apdu_buffer[OFFSET_P2] != GET_RESPONSE)) {
+                if (G_gpg_vstate.io_stream_out) {
+                    G_gpg_vstate.io_stream_out = 0;
+                    gpg_data_stream_end();
+                }
                 return;
             }
         }
-        memmove(G_io_apdu_buffer,
-                G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                G_gpg_vstate.io_length);
+        tx = G_gpg_vstate.io_length + G_gpg_vstate.io_nvm_length;
+        gpg_io_gather(tx);
 
         if (io_flags & IO_RETURN_AFTER_TX) {
-            io_exchange(CHANNEL_APDU | IO_RETURN_AFTER_TX, G_gpg_vstate.io_length);
+            io_exchange(CHANNEL_APDU | IO_RETURN_AFTER_TX, tx);
             return;
         }
-        rx = io_exchange(CHANNEL_APDU, G_gpg_vstate.io_length);
+        rx = io_exchange(CHANNEL_APDU, tx);
     }
 
     //--- full in chaining ---
@@ -459,6 +685,11 @@ void gpg_io_do(unsigned int io_flags) {
     G_gpg_vstate.io_lc = 0;
     G_gpg_vstate.io_le = 0;
     G_gpg_vstate.io_p1p2 = U2(G_gpg_vstate.io_p1, G_gpg_vstate.io_p2);
+    G_gpg_vstate.io_stream_in = 0;
+    G_gpg_vstate.io_stream_out = 0;
+    G_gpg_vstate.io_nvm_length = 0;
+    // scratch areas never survive a command
+    gpg_io_scratch_release(0);
 
     switch (G_gpg_vstate.io_ins) {
         case INS_GET_DATA:
@@ -481,13 +712,32 @@ void gpg_io_do(unsigned int io_flags) {
                 break;
             }
 
+            __attribute__((fallthrough));
+        case INS_GET_DATA_ODD:
+            // Le only, or following the data field
+            if ((G_gpg_vstate.io_ins == INS_GET_DATA_ODD) && (rx == OFFSET_CDATA)) {
+                G_gpg_vstate.io_le = G_io_apdu_buffer[OFFSET_LC];
+                break;
+            }
+            if ((G_gpg_vstate.io_ins == INS_GET_DATA_ODD) &&
+                (rx > OFFSET_CDATA + G_io_apdu_buffer[OFFSET_LC])) {
+                G_gpg_vstate.io_le = G_io_apdu_buffer[OFFSET_CDATA + G_io_apdu_buffer[OFFSET_LC]];
+            }
+
             __attribute__((fallthrough));
         default:
             G_gpg_vstate.io_lc = G_io_apdu_buffer[OFFSET_LC];
+            // streamed commands consume data chunk by chunk, without buffering
+            G_gpg_vstate.io_stream_in = gpg_data_stream_start();
+            if (G_gpg_vstate.io_stream_in) {
+                gpg_data_stream_chunk(G_io_apdu_buffer + OFFSET_CDATA, G_gpg_vstate.io_lc);
+                break;
+            }
             memmove(G_gpg_vstate.work.io_buffer,
                     G_io_apdu_buffer + OFFSET_CDATA,
                     G_gpg_vstate.io_lc);
             G_gpg_vstate.io_length = G_gpg_vstate.io_lc;
+            gpg_io_dirty();
             break;
     }
 
@@ -516,6 +766,10 @@ void gpg_io_do(unsigned int io_flags) {
         }
         G_gpg_vstate.io_cla = G_io_apdu_buffer[OFFSET_CLA];
         G_gpg_vstate.io_lc = G_io_apdu_buffer[OFFSET_LC];
+        if (G_gpg_vstate.io_stream_in) {
+            gpg_data_stream_chunk(G_io_apdu_buffer + OFFSET_CDATA, G_gpg_vstate.io_lc);
+            continue;
+        }
         if ((G_gpg_vstate.io_length + G_gpg_vstate.io_lc) > GPG_IO_BUFFER_LENGTH) {
             return;
         }
@@ -530,5 +784,6 @@ void gpg_io_do(unsigned int io_flags) {
                 G_io_apdu_buffer + OFFSET_CDATA,
                 G_gpg_vstate.io_lc);
         G_gpg_vstate.io_length += G_gpg_vstate.io_lc;
+        gpg_io_dirty();
     }
 }
@@ -24,6 +24,14 @@
 /* ---                            Application Entry                    --- */
 /* ----------------------------------------------------------------------- */
 
+/**
+ * UX ticker hook, used to age the UIF approval windows
+ *
+ */
+void app_ticker_event_callback(void) {
+    gpg_pso_uif_tick();
+}
+
 void app_main(void) {
     unsigned int io_flags = 0;
     io_flags = 0;
@@ -51,6 +51,10 @@ static void gpg_mse_set(int crt, int ref) {
 void gpg_mse_reset() {
     gpg_mse_set(KEY_AUT, 0x03);
     gpg_mse_set(KEY_DEC, 0x02);
+    // approval windows and ECDH secrets do not survive a slot or session change
+    gpg_pso_uif_reset(NULL);
+    gpg_pso_ecdh_cache_clear();
+    gpg_pso_aes_stream_reset();
 }
 
 /**
@@ -74,20 +74,23 @@ static int gpg_pin_get_state_index(unsigned int pinref) {
 static int gpg_pin_check_internal(gpg_pin_t *pin, const unsigned char *pin_val, int pin_len) {
     unsigned int counter;
     cx_err_t error = CX_INTERNAL_ERROR;
+    unsigned int mark;
+    cx_sha256_t *sha256;
+    unsigned char *H;
 
     if (pin->counter == 0) {
         return SWO_AUTH_METHOD_BLOCKED;
     }
 
+    // PIN value may stay in the I/O buffer
+    mark = gpg_io_scratch_mark();
+    sha256 = gpg_io_scratch_alloc(sizeof(cx_sha256_t));
+    H = gpg_io_scratch_alloc(CX_SHA256_SIZE);
+
     counter = pin->counter - 1;
-    cx_sha256_init(&G_gpg_vstate.work.md.sha256);
-    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &G_gpg_vstate.work.md.sha256,
-                              CX_LAST,
-                              pin_val,
-                              pin_len,
-                              G_gpg_vstate.work.md.H,
-                              sizeof(G_gpg_vstate.work.md.H)));
-    if (memcmp(G_gpg_vstate.work.md.H, pin->value, 32)) {
+    cx_sha256_init(sha256);
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) sha256, CX_LAST, pin_val, pin_len, H, CX_SHA256_SIZE));
+    if (memcmp(H, pin->value, 32)) {
         error = (counter == 0) ? SWO_AUTH_METHOD_BLOCKED : SWO_SECURITY_CONDITION_NOT_SATISFIED;
     } else {
         counter = 3;
@@ -95,6 +98,7 @@ static int gpg_pin_check_internal(gpg_pin_t *pin, const unsigned char *pin_val,
     }
 
 end:
+    gpg_io_scratch_release(mark);
     if (counter != pin->counter) {
         nvm_write(&(pin->counter), &counter, sizeof(int));
     }
@@ -145,6 +149,7 @@ int gpg_pin_set(gpg_pin_t *pin, unsigned char *pin_val, unsigned int pin_len) {
     newpin.counter = 3;
 
     nvm_write(pin, &newpin, sizeof(gpg_pin_t));
+    gpg_state_counter_bump();
 end:
     explicit_bzero(&newpin, sizeof(newpin));
     if (error != CX_OK) {
@@ -364,6 +369,7 @@ int gpg_apdu_reset_retry_counter() {
     sw = gpg_pin_set(pin_pw1,
                      G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset + rc_len,
                      pw1_len);
+    gpg_pso_ecdh_cache_clear();
     gpg_io_discard(1);
     return sw;
 }
@@ -68,22 +68,44 @@ static void gpg_pso_reset_PW1() {
     }
 }
 
+/* EC signatures are built in a scratch area before their MPI encoding */
+#define GPG_SIGN_SCRATCH_LENGTH 256
+
 /**
- * Perform a Digital Signature
+ * Compute a Digital Signature
+ * EC signatures use a scratch area, allocated after the I/O data
  *
- * @param[in]  sigKey signing key
+ * @param[in]  sigkey signing key
+ * @param[in]  in data to sign (DigestInfo, hash or message)
+ * @param[in]  in_len data length
+ * @param[out] out signature, may overlap the data to sign
+ * @param[out] out_len signature length
  *
  * @return Status Word
  *
  */
-static int gpg_sign(gpg_key_t *sigkey) {
+static int gpg_sign_data(gpg_key_t *sigkey,
+                         const unsigned char *in,
+                         unsigned int in_len,
+                         unsigned char *out,
+                         unsigned int *out_len) {
     cx_err_t error = CX_INTERNAL_ERROR;
     cx_rsa_private_key_t *rsa_key = NULL;
     unsigned int ksz, l;
     cx_ecfp_private_key_t *ecfp_key = NULL;
     unsigned int s_len, i, rs_len, info;
+    unsigned int mark = gpg_io_scratch_mark();
+    unsigned char *RS = NULL;
     unsigned char *rs;
 
+    if (sigkey->attributes.value[0] != KEY_ID_RSA) {
+        if (G_gpg_vstate.io_length + G_gpg_vstate.scratch_used + GPG_SIGN_SCRATCH_LENGTH >
+            GPG_IO_BUFFER_LENGTH) {
+            return SWO_WRONG_LENGTH;
+        }
+        RS = gpg_io_scratch_alloc(GPG_SIGN_SCRATCH_LENGTH);
+    }
+
     switch (sigkey->attributes.value[0]) {
         case KEY_ID_RSA:
             ksz = U2BE(sigkey->attributes.value, 1) >> 3;
@@ -106,35 +128,23 @@ static int gpg_sign(gpg_key_t *sigkey) {
             }
 
             // sign — require at least 11 bytes of PKCS#1 v1.5 overhead (00 01
-            // [PS>=8] 00) so that l = ksz - io_length >= 11 and the write to
-            // io_buffer[l-1] is never out-of-bounds (CWE-787).
-            if (G_gpg_vstate.io_length > ksz - 11) {
+            // [PS>=8] 00) so that l = ksz - in_len >= 11 and the write to
+            // out[l-1] is never out-of-bounds (CWE-787).
+            if (in_len > ksz - 11) {
                 error = SWO_WRONG_LENGTH;
                 break;
             }
-            l = ksz - G_gpg_vstate.io_length;
-            memmove(G_gpg_vstate.work.io_buffer + l,
-                    G_gpg_vstate.work.io_buffer,
-                    G_gpg_vstate.io_length);
-            memset(G_gpg_vstate.work.io_buffer, 0xFF, l);
-            G_gpg_vstate.work.io_buffer[0] = 0;
-            G_gpg_vstate.work.io_buffer[1] = 1;
-            G_gpg_vstate.work.io_buffer[l - 1] = 0;
-            CX_CHECK(cx_rsa_decrypt_no_throw(rsa_key,
-                                             CX_PAD_NONE,
-                                             CX_NONE,
-                                             G_gpg_vstate.work.io_buffer,
-                                             ksz,
-                                             G_gpg_vstate.work.io_buffer,
-                                             &ksz));
-            // send
-            gpg_io_discard(0);
-            gpg_io_inserted(ksz);
-            gpg_pso_reset_PW1();
+            l = ksz - in_len;
+            memmove(out + l, in, in_len);
+            memset(out, 0xFF, l);
+            out[0] = 0;
+            out[1] = 1;
+            out[l - 1] = 0;
+            CX_CHECK(cx_rsa_decrypt_no_throw(rsa_key, CX_PAD_NONE, CX_NONE, out, ksz, out, &ksz));
+            *out_len = ksz;
             error = SWO_SUCCESS;
             break;
 
-#define RS (G_gpg_vstate.work.io_buffer + (GPG_IO_BUFFER_LENGTH - 256))
         case KEY_ID_ECDSA:
             ecfp_key = &sigkey->priv_key.ecfp;
             ksz = (unsigned int) gpg_curve2domainlen(ecfp_key->curve);
@@ -142,18 +152,17 @@ static int gpg_sign(gpg_key_t *sigkey) {
                 error = SWO_CONDITIONS_NOT_SATISFIED;
                 break;
             }
-            s_len = 256;
+            s_len = GPG_SIGN_SCRATCH_LENGTH;
             CX_CHECK(cx_ecdsa_sign_no_throw(ecfp_key,
                                             CX_RND_TRNG,
                                             CX_NONE,
-                                            G_gpg_vstate.work.io_buffer,
-                                            ksz,
+                                            in,
+                                            MIN(in_len, ksz),
                                             RS,
                                             &s_len,
                                             &info));
             // re-encode r,s in MPI format
-            gpg_io_discard(0);
-
+            l = 0;
             rs_len = RS[3];
             rs = &RS[4];
 
@@ -162,28 +171,25 @@ static int gpg_sign(gpg_key_t *sigkey) {
                     rs++;
                     rs_len--;
                 }
-                gpg_io_insert_u8(0);
-                gpg_io_insert(rs, rs_len);
+                out[l++] = 0;
+                memmove(out + l, rs, rs_len);
+                l += rs_len;
                 rs = rs + rs_len;
                 rs_len = rs[1];
                 rs += 2;
             }
+            *out_len = l;
             error = SWO_SUCCESS;
             break;
 
         case KEY_ID_EDDSA:
             ecfp_key = &sigkey->priv_key.ecfp;
-            ksz = 256;
-            CX_CHECK(cx_eddsa_sign_no_throw(ecfp_key,
-                                            CX_SHA512,
-                                            G_gpg_vstate.work.io_buffer,
-                                            G_gpg_vstate.io_length,
-                                            RS,
-                                            ksz));
+            ksz = GPG_SIGN_SCRATCH_LENGTH;
+            CX_CHECK(cx_eddsa_sign_no_throw(ecfp_key, CX_SHA512, in, in_len, RS, ksz));
             CX_CHECK(cx_ecdomain_parameters_length(ecfp_key->curve, &ksz));
             ksz *= 2;
-            gpg_io_discard(0);
-            gpg_io_insert(RS, ksz);
+            memmove(out, RS, ksz);
+            *out_len = ksz;
             error = SWO_SUCCESS;
             break;
 
@@ -194,47 +200,874 @@ static int gpg_sign(gpg_key_t *sigkey) {
     }
 
 end:
+    if (RS != NULL) {
+        gpg_io_scratch_release(mark);
+    }
+    return error;
+}
+
+/**
+ * Perform a Digital Signature
+ *
+ * @param[in]  sigKey signing key
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_sign(gpg_key_t *sigkey) {
+    unsigned int len = 0;
+    int sw;
+
+    sw = gpg_sign_data(sigkey,
+                       G_gpg_vstate.work.io_buffer,
+                       G_gpg_vstate.io_length,
+                       G_gpg_vstate.work.io_buffer,
+                       &len);
+    if (sw == SWO_SUCCESS) {
+        // send
+        gpg_io_discard(0);
+        gpg_io_inserted(len);
+    }
     gpg_pso_reset_PW1();
+    return sw;
+}
+
+/**
+ * Get the largest signature length of a key
+ *
+ * @param[in]  sigkey signing key
+ *
+ * @return signature length, 0 if the key is not usable
+ *
+ */
+static unsigned int gpg_sign_max_length(const gpg_key_t *sigkey) {
+    size_t ksz = 0;
+
+    switch (sigkey->attributes.value[0]) {
+        case KEY_ID_RSA:
+            return U2BE(sigkey->attributes.value, 1) >> 3;
+        case KEY_ID_ECDSA:
+            // r and s, each with a leading zero
+            return 2 * (gpg_curve2domainlen(sigkey->priv_key.ecfp.curve) + 1);
+        case KEY_ID_EDDSA:
+            if (cx_ecdomain_parameters_length(sigkey->priv_key.ecfp.curve, &ksz) != CX_OK) {
+                return 0;
+            }
+            return 2 * ksz;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Read a TLV length from a buffer
+ *
+ * @param[in]     in buffer
+ * @param[in]     in_len buffer length
+ * @param[in,out] off current offset, moved after the length
+ * @param[out]    L read length
+ *
+ * @return 1 if a length was read, 0 otherwise
+ *
+ */
+static int gpg_pso_fetch_l(const unsigned char *in,
+                           unsigned int in_len,
+                           unsigned int *off,
+                           unsigned int *L) {
+    unsigned int n = 0;
+
+    if (*off + 1 > in_len) {
+        return 0;
+    }
+    *L = in[*off];
+    if ((*L & 0x80) != 0) {
+        n = *L & 0x7F;
+        if (((n != 1) && (n != 2)) || (*off + 1 + n > in_len)) {
+            return 0;
+        }
+        *L = (n == 1) ? in[*off + 1] : U2BE(in, *off + 1);
+    }
+    *off += 1 + n;
+    return 1;
+}
+
+/**
+ * Read a TLV tag and length from a buffer
+ *
+ * @param[in]     in buffer
+ * @param[in]     in_len buffer length
+ * @param[in,out] off current offset, moved after the length
+ * @param[out]    T read tag
+ * @param[out]    L read length
+ *
+ * @return 1 if a tag and a length were read, 0 otherwise
+ *
+ */
+static int gpg_pso_fetch_tl(const unsigned char *in,
+                            unsigned int in_len,
+                            unsigned int *off,
+                            unsigned int *T,
+                            unsigned int *L) {
+    if (*off + 1 > in_len) {
+        return 0;
+    }
+    *T = in[(*off)++];
+    if ((*T & 0x1F) == 0x1F) {
+        if (*off + 1 > in_len) {
+            return 0;
+        }
+        *T = (*T << 8) | in[(*off)++];
+    }
+    return gpg_pso_fetch_l(in, in_len, off, L);
+}
+
+/* ----------------------------------------------------------------------- */
+/* ---                      ECDH shared secret cache                   --- */
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Forget all cached ECDH shared secrets
+ * Hit and miss counters are kept
+ *
+ */
+void gpg_pso_ecdh_cache_clear(void) {
+    explicit_bzero(G_gpg_vstate.ecdh_cache.entries, sizeof(G_gpg_vstate.ecdh_cache.entries));
+    G_gpg_vstate.ecdh_cache.clock = 0;
+}
+
+/**
+ * Configure the ECDH shared secret cache, and reset its counters
+ *
+ * @param[in]  size number of cached secrets, 0 to disable the cache
+ *
+ */
+void gpg_pso_ecdh_cache_config(unsigned int size) {
+    gpg_pso_ecdh_cache_clear();
+    G_gpg_vstate.ecdh_cache.size = MIN(size, GPG_ECDH_CACHE_ENTRIES);
+    G_gpg_vstate.ecdh_cache.hits = 0;
+    G_gpg_vstate.ecdh_cache.misses = 0;
+}
+
+/**
+ * Compute the cache tag of an ECDH operation
+ *
+ * @param[in]  ecfp_key private key
+ * @param[in]  pub ephemeral public key
+ * @param[in]  pub_len ephemeral public key length
+ * @param[out] tag cache tag (32 bytes)
+ *
+ * @return Error code
+ *
+ */
+static cx_err_t gpg_ecdh_cache_tag(const cx_ecfp_private_key_t *ecfp_key,
+                                   const unsigned char *pub,
+                                   unsigned int pub_len,
+                                   unsigned char *tag) {
+    cx_err_t error = CX_INTERNAL_ERROR;
+    cx_sha256_t sha256;
+
+    CX_CHECK(cx_sha256_init_no_throw(&sha256));
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &sha256, 0, ecfp_key->d, ecfp_key->d_len, NULL, 0));
+    CX_CHECK(cx_hash_no_throw((cx_hash_t *) &sha256, CX_LAST, pub, pub_len, tag, 32));
+
+end:
+    explicit_bzero(&sha256, sizeof(sha256));
     return error;
 }
 
 /**
- * APDU handler to Perform Security Operation
+ * Look for a cached ECDH shared secret
+ *
+ * @param[in]  tag cache tag
+ * @param[out] secret shared secret
+ * @param[in]  len shared secret length
+ *
+ * @return 1 if the secret was found, 0 otherwise
+ *
+ */
+static int gpg_ecdh_cache_get(const unsigned char *tag, unsigned char *secret, unsigned int len) {
+    gpg_ecdh_entry_t *entry;
+    unsigned int i;
+
+    for (i = 0; i < G_gpg_vstate.ecdh_cache.size; i++) {
+        entry = &G_gpg_vstate.ecdh_cache.entries[i];
+        if ((entry->length == len) && (memcmp(entry->tag, tag, sizeof(entry->tag)) == 0)) {
+            memmove(secret, entry->secret, len);
+            entry->used = ++G_gpg_vstate.ecdh_cache.clock;
+            G_gpg_vstate.ecdh_cache.hits++;
+            return 1;
+        }
+    }
+    G_gpg_vstate.ecdh_cache.misses++;
+    return 0;
+}
+
+/**
+ * Cache an ECDH shared secret, replacing the least recently used one
+ *
+ * @param[in]  tag cache tag
+ * @param[in]  secret shared secret
+ * @param[in]  len shared secret length
+ *
+ */
+static void gpg_ecdh_cache_put(const unsigned char *tag,
+                               const unsigned char *secret,
+                               unsigned int len) {
+    gpg_ecdh_entry_t *entry = NULL;
+    unsigned int i;
+
+    if (len > GPG_ECDH_SECRET_LENGTH) {
+        return;
+    }
+    for (i = 0; i < G_gpg_vstate.ecdh_cache.size; i++) {
+        if ((entry == NULL) || (G_gpg_vstate.ecdh_cache.entries[i].used < entry->used)) {
+            entry = &G_gpg_vstate.ecdh_cache.entries[i];
+        }
+    }
+    if (entry == NULL) {
+        return;
+    }
+    memmove(entry->tag, tag, sizeof(entry->tag));
+    memmove(entry->secret, secret, len);
+    entry->length = len;
+    entry->used = ++G_gpg_vstate.ecdh_cache.clock;
+}
+
+/**
+ * Check the AES key is set, with a supported length
+ *
+ * @param[in] aes_key AES key
+ *
+ * @return 1 if usable, 0 otherwise
+ *
+ */
+static int gpg_pso_aes_key_check(const cx_aes_key_t *aes_key) {
+    // AES-128, AES-192 and AES-256
+    switch (aes_key->size) {
+        case 16:
+        case 24:
+        case 32:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Decipher a cryptogram
+ * The cryptogram starts with its padding indicator byte
+ *
+ * @param[in]     deckey decryption key
+ * @param[in]     in cryptogram
+ * @param[in]     in_len cryptogram length
+ * @param[out]    out plain data, may be before the cryptogram in the same buffer
+ * @param[in,out] out_len out buffer size, then plain data length
  *
  * @return Status Word
  *
  */
-int gpg_apdu_pso() {
+static int gpg_decipher_data(gpg_key_t *deckey,
+                             const unsigned char *in,
+                             unsigned int in_len,
+                             unsigned char *out,
+                             unsigned int *out_len) {
     cx_err_t error = CX_INTERNAL_ERROR;
-    unsigned int t, l, ksz;
-    unsigned int cnt, pad_byte;
-    unsigned int msg_len;
+    unsigned int t, l, off;
+    size_t ksz = 0;
     unsigned int curve;
     cx_aes_key_t *aes_key = NULL;
     cx_rsa_private_key_t *rsa_key = NULL;
     cx_ecfp_private_key_t *ecfp_key = NULL;
+    unsigned int pub_len;
+    uint8_t secret[GPG_ECDH_SECRET_LENGTH];
+    uint8_t tag[32];
+
+    if (in_len < 1) {
+        return SWO_WRONG_LENGTH;
+    }
+    off = 1;
+
+    switch (in[0]) {
+        case PAD_RSA:
+            if (deckey->attributes.value[0] != KEY_ID_RSA) {
+                PRINTF("[PSO] - Wrong attribute %d != %d\n",
+                       deckey->attributes.value[0],
+                       KEY_ID_RSA);
+                error = SWO_CONDITIONS_NOT_SATISFIED;
+                break;
+            }
+            ksz = U2BE(deckey->attributes.value, 1) >> 3;
+            switch (ksz) {
+                case 2048 / 8:
+                    rsa_key = (cx_rsa_private_key_t *) &deckey->priv_key.rsa2048;
+                    break;
+                case 3072 / 8:
+                    rsa_key = (cx_rsa_private_key_t *) &deckey->priv_key.rsa3072;
+                    break;
+                case 4096 / 8:
+                    rsa_key = (cx_rsa_private_key_t *) &deckey->priv_key.rsa4096;
+                    break;
+            }
+
+            if ((rsa_key == NULL) || (rsa_key->size != ksz)) {
+                PRINTF("[PSO] - Wrong RSA key size %d != %d\n", rsa_key->size, ksz);
+                error = SWO_CONDITIONS_NOT_SATISFIED;
+                break;
+            }
+            if (*out_len < ksz) {
+                error = SWO_WRONG_LENGTH;
+                break;
+            }
+            CX_CHECK(cx_rsa_decrypt_no_throw(rsa_key,
+                                             CX_PAD_PKCS1_1o5,
+                                             CX_NONE,
+                                             in + off,
+                                             in_len - off,
+                                             out,
+                                             &ksz));
+            *out_len = ksz;
+            error = SWO_SUCCESS;
+            break;
+
+        case PAD_AES:
+            aes_key = &G_gpg_vstate.kslot->AES_dec;
+            if (!gpg_pso_aes_key_check(aes_key)) {
+                PRINTF("[PSO] - Wrong AES key size %d\n", aes_key->size);
+                error = SWO_CONDITIONS_NOT_SATISFIED;
+                break;
+            }
+            ksz = *out_len;
+            CX_CHECK(cx_aes_no_throw(aes_key,
+                                     CX_DECRYPT | CX_CHAIN_CBC | CX_LAST,
+                                     in + off,
+                                     in_len - off,
+                                     out,
+                                     &ksz));
+            *out_len = ksz;
+            error = SWO_SUCCESS;
+            break;
+
+        case PAD_ECDH:
+            if (deckey->attributes.value[0] != KEY_ID_ECDH) {
+                PRINTF("[PSO] - PSO:DEC:ECDH - Wrong key type %d != %d\n",
+                       deckey->attributes.value[0],
+                       KEY_ID_ECDH);
+                error = SWO_CONDITIONS_NOT_SATISFIED;
+                break;
+            }
+            ecfp_key = &deckey->priv_key.ecfp;
+            curve = gpg_oid2curve(deckey->attributes.value + 1, deckey->attributes.length - 1);
+            if (ecfp_key->curve != curve) {
+                PRINTF("[PSO] - PSO:DEC:ECDH - Wrong curve %d != %d\n", ecfp_key->curve, curve);
+                error = SWO_CONDITIONS_NOT_SATISFIED;
+                break;
+            }
+            // Check APDU content tags
+            if (!gpg_pso_fetch_l(in, in_len, &off, &l) ||
+                !gpg_pso_fetch_tl(in, in_len, &off, &t, &l)) {
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            // TAG 0x7f49 announces a Public Key DO
+            if (t != 0x7f49) {
+                PRINTF("[PSO] - Wrong tag 0x%x != 0x%x\n", t, 0x7f49);
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            if (!gpg_pso_fetch_tl(in, in_len, &off, &t, &l)) {
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            // TAG 0x86 announces an External Public Key (with its length)
+            if (t != 0x86) {
+                PRINTF("[PSO] - Wrong tag 0x%x != 0x%x\n", t, 0x86);
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            CX_CHECK(cx_ecdomain_parameters_length(ecfp_key->curve, &ksz));
+            if (*out_len < ksz) {
+                error = SWO_WRONG_LENGTH;
+                break;
+            }
+
+            pub_len = (curve == CX_CURVE_Curve25519) ? 32 : 65;
+            if ((off + pub_len > in_len) || ((curve == CX_CURVE_Curve25519) && (l != 32))) {
+                PRINTF("[PSO] - PSO:DEC:ECDH - Wrong Ext Pub Key size %d\n", l);
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            if ((curve == CX_CURVE_Curve25519) && (ksz != 32)) {
+                PRINTF("[PSO] - PSO:DEC:ECDH - Wrong curve Key size %d\n", ksz);
+                error = SWO_INCORRECT_DATA;
+                break;
+            }
+            // a cached secret avoids the scalar multiplication
+            if (G_gpg_vstate.ecdh_cache.size != 0) {
+                CX_CHECK(gpg_ecdh_cache_tag(ecfp_key, in + off, pub_len, tag));
+                if (gpg_ecdh_cache_get(tag, out, ksz)) {
+                    *out_len = ksz;
+                    error = SWO_SUCCESS;
+                    break;
+                }
+            }
+
+            if (curve == CX_CURVE_Curve25519) {
+                uint8_t raw_public_key[65];
+                cx_ecpoint_t public_point;
+                uint8_t i;
+
+                // Reverse key bytes order
+                for (i = 0; i <= 31; i++) {
+                    raw_public_key[i] = in[off + 31 - i];
+                }
+
+                CX_CHECK(cx_bn_lock(32, 0));
+                CX_CHECK(cx_ecpoint_alloc(&public_point, CX_CURVE_Curve25519));
+                CX_CHECK(cx_ecpoint_decompress(&public_point, raw_public_key, 32, 0));
+                CX_CHECK(cx_ecpoint_export(&public_point,
+                                           raw_public_key + 1,
+                                           32,
+                                           raw_public_key + 1 + 32,
+                                           32));
+                CX_CHECK(cx_bn_unlock());
+                raw_public_key[0] = 0x04;
+                CX_CHECK(cx_ecdh_no_throw(ecfp_key,
+                                          CX_ECDH_X,
+                                          raw_public_key,
+                                          sizeof(raw_public_key),
+                                          secret,
+                                          32));
+                // Reverse key bytes order
+                for (i = 0; i <= 31; i++) {
+                    out[i] = secret[31 - i];
+                }
+            } else {
+                CX_CHECK(
+                    cx_ecdh_no_throw(ecfp_key, CX_ECDH_X, in + off, 65, secret, sizeof(secret)));
+                memmove(out, secret, ksz);
+            }
+            if (G_gpg_vstate.ecdh_cache.size != 0) {
+                gpg_ecdh_cache_put(tag, out, ksz);
+            }
+            *out_len = ksz;
+            error = SWO_SUCCESS;
+            break;
+
+        // --- PSO:DEC:xx NOT SUPPORTED
+        default:
+            error = SWO_REFERENCED_DATA_NOT_FOUND;
+            break;
+    }
+end:
+    explicit_bzero(secret, sizeof(secret));
+    explicit_bzero(tag, sizeof(tag));
+    return error;
+}
+
+/**
+ * Get the largest plain data length of a decryption key
+ *
+ * @param[in]  deckey decryption key
+ *
+ * @return plain data length, 0 if the key can not be used
+ *
+ */
+static unsigned int gpg_decipher_max_length(const gpg_key_t *deckey) {
+    size_t ksz = 0;
+
+    switch (deckey->attributes.value[0]) {
+        case KEY_ID_RSA:
+            return U2BE(deckey->attributes.value, 1) >> 3;
+        case KEY_ID_ECDH:
+            if (cx_ecdomain_parameters_length(deckey->priv_key.ecfp.curve, &ksz) != CX_OK) {
+                return 0;
+            }
+            return ksz;
+        default:
+            return 0;
+    }
+}
+
+/* ----------------------------------------------------------------------- */
+/* ---                           Batch PSO                            --- */
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Start a batch operation
+ * Command data is a list of items, each prefixed by its length on 2 bytes.
+ * Items wait in a scratch area while results are produced one by one, as
+ * the response is sent
+ *
+ * @param[in]  key key used for all items
+ * @param[in]  max_len largest result length
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_pso_batch_start(gpg_key_t *key, unsigned int max_len) {
+    unsigned int off, len, items, mark, room;
+    unsigned char *area;
+
+    explicit_bzero(&G_gpg_vstate.batch, sizeof(G_gpg_vstate.batch));
+    if (max_len == 0) {
+        return SWO_CONDITIONS_NOT_SATISFIED;
+    }
+    // check list format
+    len = G_gpg_vstate.io_length;
+    items = 0;
+    for (off = 0; off < len; off += 2 + U2BE(G_gpg_vstate.work.io_buffer, off)) {
+        if ((off + 2 > len) || (U2BE(G_gpg_vstate.work.io_buffer, off) == 0)) {
+            return SWO_INCORRECT_DATA;
+        }
+        items++;
+    }
+    if ((items == 0) || (off != len)) {
+        return SWO_INCORRECT_DATA;
+    }
+    // PW1 valid for one PSO:CDS only allows a single signature
+    if ((G_gpg_vstate.io_p1p2 == PSO_CDS_BATCH) && (items > 1) &&
+        (N_gpg_pstate->PW_status[0] == 0)) {
+        return SWO_SECURITY_CONDITION_NOT_SATISFIED;
+    }
+
+    mark = gpg_io_scratch_mark();
+    gpg_io_discard(0);
+    area = gpg_io_scratch_alloc(len);
+    memmove(area, G_gpg_vstate.work.io_buffer, len);
+    // the response being sent, one result and the signature scratch area
+    // must fit before pending items
+    room = GPG_APDU_LENGTH + 2 + 2 + max_len;
+    if (G_gpg_vstate.io_p1p2 == PSO_CDS_BATCH) {
+        room += GPG_SIGN_SCRATCH_LENGTH;
+    }
+    if (room > GPG_IO_BUFFER_LENGTH - G_gpg_vstate.scratch_used) {
+        gpg_io_scratch_release(mark);
+        return SWO_WRONG_LENGTH;
+    }
+
+    G_gpg_vstate.batch.key = key;
+    G_gpg_vstate.batch.mark = mark;
+    G_gpg_vstate.batch.offset = area - G_gpg_vstate.work.io_buffer;
+    G_gpg_vstate.batch.end = G_gpg_vstate.batch.offset + len;
+    G_gpg_vstate.io_stream_out = 1;
+    return SWO_SUCCESS;
+}
+
+/**
+ * Complete a batch operation
+ * Signatures already computed are counted, even if the response was not fully read
+ *
+ */
+void gpg_pso_batch_end(void) {
+    unsigned int cnt;
+
+    if (G_gpg_vstate.batch.key == NULL) {
+        return;
+    }
+    if ((G_gpg_vstate.io_p1p2 == PSO_CDS_BATCH) && (G_gpg_vstate.batch.count != 0)) {
+        cnt = G_gpg_vstate.kslot->sig_count + G_gpg_vstate.batch.count;
+        nvm_write(&G_gpg_vstate.kslot->sig_count, &cnt, sizeof(unsigned int));
+        gpg_pso_reset_PW1();
+    }
+    gpg_io_scratch_release(G_gpg_vstate.batch.mark);
+    explicit_bzero(&G_gpg_vstate.batch, sizeof(G_gpg_vstate.batch));
+}
+
+/**
+ * Process the next batch item, its result is added at the end of the response
+ *
+ * @return SWO_RESPONSE_BYTES_AVAILABLE if more items follow,
+ *         SWO_SUCCESS after the last one, or an error Status Word
+ *
+ */
+int gpg_pso_batch_next(void) {
+    unsigned char *item, *out;
+    unsigned int len, out_len = 0;
+    int sw;
+
+    if (G_gpg_vstate.batch.key == NULL) {
+        return SWO_CONDITIONS_NOT_SATISFIED;
+    }
+    item = G_gpg_vstate.work.io_buffer + G_gpg_vstate.batch.offset;
+    len = U2BE(item, 0);
+    out = G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_length;
+
+    switch (G_gpg_vstate.io_p1p2) {
+        case PSO_CDS_BATCH:
+            sw = gpg_sign_data(G_gpg_vstate.batch.key, item + 2, len, out + 2, &out_len);
+            break;
+        case PSO_DEC_BATCH:
+            // plain data may use all the room left before pending items
+            out_len = GPG_IO_BUFFER_LENGTH - G_gpg_vstate.scratch_used -
+                      (G_gpg_vstate.io_length + 2);
+            sw = gpg_decipher_data(G_gpg_vstate.batch.key, item + 2, len, out + 2, &out_len);
+            break;
+        default:
+            sw = SWO_REFERENCED_DATA_NOT_FOUND;
+            break;
+    }
+    if (sw != SWO_SUCCESS) {
+        gpg_pso_batch_end();
+        return sw;
+    }
+    U2BE_ENCODE(out, 0, out_len);
+    gpg_io_inserted(2 + out_len);
+    G_gpg_vstate.batch.offset += 2 + len;
+    G_gpg_vstate.batch.count++;
+
+    if (G_gpg_vstate.batch.offset < G_gpg_vstate.batch.end) {
+        return SWO_RESPONSE_BYTES_AVAILABLE;
+    }
+    gpg_pso_batch_end();
+    return SWO_SUCCESS;
+}
+
+/* ----------------------------------------------------------------------- */
+/* ---                          AES-CBC stream                          --- */
+/* ----------------------------------------------------------------------- */
+
+/**
+ * Abort any pending AES-CBC stream
+ *
+ */
+void gpg_pso_aes_stream_reset(void) {
+    explicit_bzero(&G_gpg_vstate.aes_stream, sizeof(G_gpg_vstate.aes_stream));
+}
+
+/**
+ * Encrypt or decrypt one part of an AES-CBC stream with the AES key
+ * Each part is a whole number of blocks, the CBC chaining value is kept
+ * from one command to the next. The stream IV is random and returned ahead
+ * of the first enciphered part, and expected ahead of the first deciphered
+ * part.
+ *
+ * @return Status Word
+ *
+ */
+static int gpg_pso_aes_stream(void) {
+    cx_err_t error = CX_INTERNAL_ERROR;
+    cx_aes_key_t *aes_key = &G_gpg_vstate.kslot->AES_dec;
+    unsigned int mode = G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK;
+    unsigned char *in = G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset;
+    unsigned int len = G_gpg_vstate.io_length - G_gpg_vstate.io_offset;
+    unsigned int iv_len = 0;
+    unsigned char iv[CX_AES_BLOCK_SIZE];
+    size_t out_len = 0;
+
+    if (G_gpg_vstate.io_p2 & PSO_STREAM_FIRST) {
+        gpg_pso_aes_stream_reset();
+        G_gpg_vstate.aes_stream.mode = mode;
+        iv_len = CX_AES_BLOCK_SIZE;
+    }
+    if ((G_gpg_vstate.aes_stream.mode != mode) || !gpg_pso_aes_key_check(aes_key)) {
+        error = SWO_CONDITIONS_NOT_SATISFIED;
+        goto end;
+    }
+    if ((len % CX_AES_BLOCK_SIZE) != 0) {
+        error = SWO_WRONG_LENGTH;
+        goto end;
+    }
+    if (iv_len != 0) {
+        if (mode == PSO_ENC_STREAM) {
+            // room for the IV ahead of the result
+            if (len + iv_len > GPG_IO_BUFFER_LENGTH) {
+                error = SWO_WRONG_LENGTH;
+                goto end;
+            }
+            cx_rng(G_gpg_vstate.aes_stream.iv, CX_AES_BLOCK_SIZE);
+        } else {
+            if (len < iv_len) {
+                error = SWO_WRONG_LENGTH;
+                goto end;
+            }
+            memmove(G_gpg_vstate.aes_stream.iv, in, CX_AES_BLOCK_SIZE);
+            in += iv_len;
+            len -= iv_len;
+            iv_len = 0;
+        }
+    }
+
+    if (len != 0) {
+        memmove(iv, G_gpg_vstate.aes_stream.iv, CX_AES_BLOCK_SIZE);
+        if (mode == PSO_DEC_STREAM) {
+            // next chaining value is the last cryptogram block
+            memmove(G_gpg_vstate.aes_stream.iv, in + len - CX_AES_BLOCK_SIZE, CX_AES_BLOCK_SIZE);
+        }
+        out_len = len;
+        CX_CHECK(cx_aes_iv_no_throw(
+            aes_key,
+            ((mode == PSO_ENC_STREAM) ? CX_ENCRYPT : CX_DECRYPT) | CX_CHAIN_CBC | CX_LAST,
+            iv,
+            CX_AES_BLOCK_SIZE,
+            in,
+            len,
+            G_gpg_vstate.work.io_buffer,
+            &out_len));
+    }
+    if (iv_len != 0) {
+        // IV ahead of the first enciphered part
+        memmove(G_gpg_vstate.work.io_buffer + iv_len, G_gpg_vstate.work.io_buffer, out_len);
+        memmove(G_gpg_vstate.work.io_buffer, G_gpg_vstate.aes_stream.iv, iv_len);
+        out_len += iv_len;
+    }
+    if ((mode == PSO_ENC_STREAM) && (out_len != 0)) {
+        memmove(G_gpg_vstate.aes_stream.iv,
+                G_gpg_vstate.work.io_buffer + out_len - CX_AES_BLOCK_SIZE,
+                CX_AES_BLOCK_SIZE);
+    }
+    // send
+    gpg_io_discard(0);
+    gpg_io_inserted(out_len);
+    error = SWO_SUCCESS;
+
+end:
+    if ((error != SWO_SUCCESS) || (G_gpg_vstate.io_p2 & PSO_STREAM_LAST)) {
+        gpg_pso_aes_stream_reset();
+    }
+    explicit_bzero(iv, sizeof(iv));
+    return error;
+}
+
+/**
+ * Get the UIF approval window index of a key in the current slot
+ *
+ * @param[in] key key to check
+ *
+ * @return window index
+ *
+ */
+static unsigned int gpg_uif_index(const gpg_key_t *key) {
+    if (key == &G_gpg_vstate.kslot->sig) {
+        return 0;
+    }
+    if (key == &G_gpg_vstate.kslot->dec) {
+        return 1;
+    }
+    return 2;
+}
+
+/**
+ * Close UIF approval windows
+ *
+ * @param[in] key key whose window is closed, NULL for all
+ *
+ */
+void gpg_pso_uif_reset(const gpg_key_t *key) {
+    if (key == NULL) {
+        explicit_bzero(G_gpg_vstate.uif_window, sizeof(G_gpg_vstate.uif_window));
+        return;
+    }
+    explicit_bzero(&G_gpg_vstate.uif_window[gpg_uif_index(key)],
+                   sizeof(G_gpg_vstate.uif_window[0]));
+}
+
+_Static_assert((1000 % UIF_TICKER_PERIOD) == 0, "UIF ticker period must divide a second");
+
+/**
+ * Age the time bounded UIF approval windows, on UX ticker
+ *
+ */
+void gpg_pso_uif_tick(void) {
+    unsigned int i;
+
+    for (i = 0; i < ARRAYLEN(G_gpg_vstate.uif_window); i++) {
+        if (G_gpg_vstate.uif_window[i].ticks) {
+            G_gpg_vstate.uif_window[i].ticks--;
+        }
+    }
+}
+
+/**
+ * Check the User Interaction Flag of a key
+ * A confirmation opens the approval window configured in the UIF second byte,
+ * subsequent operations within this window are not confirmed again
+ *
+ * @param[in] key key used by the operation
+ *
+ * @return 1 if the operation may proceed, 0 if a confirmation is requested
+ *
+ */
+static int gpg_uif_check(const gpg_key_t *key) {
+    unsigned int n;
+    unsigned int idx = gpg_uif_index(key);
+
+    if (key->UIF[0] == 0) {
+        return 1;
+    }
+    if (G_gpg_vstate.UIF_flags) {
+        // just confirmed, this operation is the first of the window
+        G_gpg_vstate.UIF_flags = 0;
+        gpg_pso_uif_reset(key);
+        n = key->UIF[1] & UIF_WINDOW_N_MASK;
+        if (n == 0) {
+            return 1;
+        }
+        switch (key->UIF[1] & UIF_WINDOW_UNIT_MASK) {
+            case UIF_WINDOW_OPS:
+                G_gpg_vstate.uif_window[idx].ops = n - 1;
+                break;
+            case UIF_WINDOW_OPS32:
+                G_gpg_vstate.uif_window[idx].ops = (n * 32) - 1;
+                break;
+            case UIF_WINDOW_MINUTES:
+                G_gpg_vstate.uif_window[idx].ticks = n * 60 * (1000 / UIF_TICKER_PERIOD);
+                break;
+            default:
+                break;
+        }
+        return 1;
+    }
+    if (G_gpg_vstate.uif_window[idx].ticks) {
+        return 1;
+    }
+    if (G_gpg_vstate.uif_window[idx].ops) {
+        G_gpg_vstate.uif_window[idx].ops--;
+        return 1;
+    }
+    ui_menu_uifconfirm_display(0);
+    return 0;
+}
+
+/**
+ * APDU handler to Perform Security Operation
+ *
+ * @return Status Word
+ *
+ */
+int gpg_apdu_pso() {
+    cx_err_t error = CX_INTERNAL_ERROR;
+    unsigned int ksz;
+    unsigned int cnt;
+    unsigned int msg_len;
+    cx_aes_key_t *aes_key = NULL;
+
+    // private key operations use the work area as scratch
+    gpg_io_taint();
+
+    // --- PSO:ENC/DEC AES stream, confirmed once at start ---
+    if (((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_ENC_STREAM) ||
+        ((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_DEC_STREAM)) {
+        if ((G_gpg_vstate.io_p2 & PSO_STREAM_FIRST) && !gpg_uif_check(G_gpg_vstate.mse_dec)) {
+            return 0;
+        }
+        return gpg_pso_aes_stream();
+    }
 
     // UIF HANDLE
     switch (G_gpg_vstate.io_p1p2) {
         // --- PSO:CDS ---
         case PSO_CDS:
-            if (G_gpg_vstate.kslot->sig.UIF[0]) {
-                if ((G_gpg_vstate.UIF_flags) == 0) {
-                    ui_menu_uifconfirm_display(0);
-                    return 0;
-                }
-                G_gpg_vstate.UIF_flags = 0;
+        case PSO_CDS_BATCH:
+            if (!gpg_uif_check(&G_gpg_vstate.kslot->sig)) {
+                return 0;
             }
             break;
         // --- PSO:DEC ---
         case PSO_DEC:
+        case PSO_DEC_BATCH:
         case PSO_ENC:
-            if (G_gpg_vstate.mse_dec->UIF[0]) {
-                if ((G_gpg_vstate.UIF_flags) == 0) {
-                    ui_menu_uifconfirm_display(0);
-                    return 0;
-                }
-                G_gpg_vstate.UIF_flags = 0;
+            if (!gpg_uif_check(G_gpg_vstate.mse_dec)) {
+                return 0;
             }
             break;
     }
@@ -247,9 +1080,15 @@ int gpg_apdu_pso() {
             nvm_write(&G_gpg_vstate.kslot->sig_count, &cnt, sizeof(unsigned int));
             break;
 
+        case PSO_CDS_BATCH:
+            // signatures are computed while the response is sent
+            error = gpg_pso_batch_start(&G_gpg_vstate.kslot->sig,
+                                        gpg_sign_max_length(&G_gpg_vstate.kslot->sig));
+            break;
+
         case PSO_ENC:
             aes_key = &G_gpg_vstate.kslot->AES_dec;
-            if (!(aes_key->size != CX_AES_128_KEY_LEN)) {
+            if (!gpg_pso_aes_key_check(aes_key)) {
                 return SWO_CONDITIONS_NOT_SATISFIED;
             }
             msg_len = G_gpg_vstate.io_length - G_gpg_vstate.io_offset;
@@ -268,178 +1107,25 @@ int gpg_apdu_pso() {
             break;
 
         case PSO_DEC:
-            pad_byte = gpg_io_fetch_u8();
-
-            switch (pad_byte) {
-                case PAD_RSA:
-                    if (G_gpg_vstate.mse_dec->attributes.value[0] != KEY_ID_RSA) {
-                        PRINTF("[PSO] - Wrong attribute %d != %d\n",
-                               G_gpg_vstate.mse_dec->attributes.value[0],
-                               KEY_ID_RSA);
-                        error = SWO_CONDITIONS_NOT_SATISFIED;
-                        break;
-                    }
-                    ksz = U2BE(G_gpg_vstate.mse_dec->attributes.value, 1) >> 3;
-                    switch (ksz) {
-                        case 2048 / 8:
-                            rsa_key =
-                                (cx_rsa_private_key_t *) &G_gpg_vstate.mse_dec->priv_key.rsa2048;
-                            break;
-                        case 3072 / 8:
-                            rsa_key =
-                                (cx_rsa_private_key_t *) &G_gpg_vstate.mse_dec->priv_key.rsa3072;
-                            break;
-                        case 4096 / 8:
-                            rsa_key =
-                                (cx_rsa_private_key_t *) &G_gpg_vstate.mse_dec->priv_key.rsa4096;
-                            break;
-                    }
-
-                    if ((rsa_key == NULL) || (rsa_key->size != ksz)) {
-                        PRINTF("[PSO] - Wrong RSA key size %d != %d\n", rsa_key->size, ksz);
-                        error = SWO_CONDITIONS_NOT_SATISFIED;
-                        break;
-                    }
-                    msg_len = G_gpg_vstate.io_length - G_gpg_vstate.io_offset;
-                    CX_CHECK(cx_rsa_decrypt_no_throw(
-                        rsa_key,
-                        CX_PAD_PKCS1_1o5,
-                        CX_NONE,
-                        G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                        msg_len,
-                        G_gpg_vstate.work.io_buffer,
-                        &ksz));
-                    // send
-                    gpg_io_discard(0);
-                    gpg_io_inserted(ksz);
-                    error = SWO_SUCCESS;
-                    break;
-
-                case PAD_AES:
-                    aes_key = &G_gpg_vstate.kslot->AES_dec;
-                    if (!(aes_key->size != CX_AES_128_KEY_LEN)) {
-                        PRINTF("[PSO] - Wrong AES key size %d != %d\n",
-                               aes_key->size,
-                               CX_AES_128_KEY_LEN);
-                        error = SWO_CONDITIONS_NOT_SATISFIED;
-                        break;
-                    }
-                    msg_len = G_gpg_vstate.io_length - G_gpg_vstate.io_offset;
-                    ksz = GPG_IO_BUFFER_LENGTH;
-                    CX_CHECK(cx_aes_no_throw(aes_key,
-                                             CX_DECRYPT | CX_CHAIN_CBC | CX_LAST,
-                                             G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                                             msg_len,
-                                             G_gpg_vstate.work.io_buffer,
-                                             &ksz));
-                    // send
-                    gpg_io_discard(0);
-                    gpg_io_inserted(ksz);
-                    error = SWO_SUCCESS;
-                    break;
-
-                case PAD_ECDH:
-                    if (G_gpg_vstate.mse_dec->attributes.value[0] != KEY_ID_ECDH) {
-                        PRINTF("[PSO] - PSO:DEC:ECDH - Wrong key type %d != %d\n",
-                               G_gpg_vstate.mse_dec->attributes.value[0],
-                               KEY_ID_ECDH);
-                        error = SWO_CONDITIONS_NOT_SATISFIED;
-                        break;
-                    }
-                    ecfp_key = &G_gpg_vstate.mse_dec->priv_key.ecfp;
-                    curve = gpg_oid2curve(G_gpg_vstate.mse_dec->attributes.value + 1,
-                                          G_gpg_vstate.mse_dec->attributes.length - 1);
-                    if (ecfp_key->curve != curve) {
-                        PRINTF("[PSO] - PSO:DEC:ECDH - Wrong curve %d != %d\n",
-                               ecfp_key->curve,
-                               curve);
-                        error = SWO_CONDITIONS_NOT_SATISFIED;
-                        break;
-                    }
-                    // Check APDU content tags
-                    gpg_io_fetch_l(&l);
-                    gpg_io_fetch_tl(&t, &l);
-                    // TAG 0x7f49 announces a Public Key DO
-                    if (t != 0x7f49) {
-                        PRINTF("[PSO] - Wrong tag 0x%x != 0x%x\n", t, 0x7f49);
-                        error = SWO_INCORRECT_DATA;
-                        break;
-                    }
-                    gpg_io_fetch_tl(&t, &l);
-                    // TAG 0x86 announces an External Public Key (with its length)
-                    if (t != 0x86) {
-                        PRINTF("[PSO] - Wrong tag 0x%x != 0x%x\n", t, 0x86);
-                        error = SWO_INCORRECT_DATA;
-                        break;
-                    }
-
-                    if (curve == CX_CURVE_Curve25519) {
-                        uint8_t raw_public_key[65];
-                        uint8_t secret[32];
-                        cx_ecpoint_t public_point;
-                        uint8_t i;
-
-                        if (l != 32) {
-                            PRINTF("[PSO] - PSO:DEC:ECDH - Wrong Ext Pub Key size %d\n", l);
-                            error = SWO_INCORRECT_DATA;
-                            break;
-                        }
-
-                        CX_CHECK(cx_ecdomain_parameters_length(ecfp_key->curve, &ksz));
-                        if (ksz != 32) {
-                            PRINTF("[PSO] - PSO:DEC:ECDH - Wrong curve Key size %d\n", ksz);
-                            error = SWO_INCORRECT_DATA;
-                            break;
-                        }
-                        // Reverse key bytes order
-                        for (i = 0; i <= 31; i++) {
-                            raw_public_key[i] =
-                                (G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset)[31 - i];
-                        }
-
-                        CX_CHECK(cx_bn_lock(32, 0));
-                        CX_CHECK(cx_ecpoint_alloc(&public_point, CX_CURVE_Curve25519));
-                        CX_CHECK(cx_ecpoint_decompress(&public_point, raw_public_key, 32, 0));
-                        CX_CHECK(cx_ecpoint_export(&public_point,
-                                                   raw_public_key + 1,
-                                                   32,
-                                                   raw_public_key + 1 + 32,
-                                                   32));
-                        CX_CHECK(cx_bn_unlock());
-                        raw_public_key[0] = 0x04;
-                        CX_CHECK(cx_ecdh_no_throw(ecfp_key,
-                                                  CX_ECDH_X,
-                                                  raw_public_key,
-                                                  sizeof(raw_public_key),
-                                                  secret,
-                                                  sizeof(secret)));
-                        // Reverse key bytes order
-                        for (i = 0; i <= 31; i++) {
-                            G_gpg_vstate.work.io_buffer[128 + i] = secret[31 - i];
-                        }
-                    } else {
-                        CX_CHECK(
-                            cx_ecdh_no_throw(ecfp_key,
-                                             CX_ECDH_X,
-                                             G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
-                                             65,
-                                             G_gpg_vstate.work.io_buffer + 128,
-                                             160));
-                        CX_CHECK(cx_ecdomain_parameters_length(ecfp_key->curve, &ksz));
-                    }
-                    // send
-                    gpg_io_discard(0);
-                    gpg_io_insert(G_gpg_vstate.work.io_buffer + 128, ksz);
-                    error = SWO_SUCCESS;
-                    break;
-
-                // --- PSO:DEC:xx NOT SUPPORTED
-                default:
-                    error = SWO_REFERENCED_DATA_NOT_FOUND;
-                    break;
+            ksz = GPG_IO_BUFFER_LENGTH;
+            error = gpg_decipher_data(G_gpg_vstate.mse_dec,
+                                      G_gpg_vstate.work.io_buffer + G_gpg_vstate.io_offset,
+                                      G_gpg_vstate.io_length - G_gpg_vstate.io_offset,
+                                      G_gpg_vstate.work.io_buffer,
+                                      &ksz);
+            if (error == SWO_SUCCESS) {
+                // send
+                gpg_io_discard(0);
+                gpg_io_inserted(ksz);
             }
             break;
 
+        case PSO_DEC_BATCH:
+            // cryptograms are deciphered while the response is sent
+            error = gpg_pso_batch_start(G_gpg_vstate.mse_dec,
+                                        gpg_decipher_max_length(G_gpg_vstate.mse_dec));
+            break;
+
         //--- PSO:yy NOT SUPPORTED ---
         default:
             error = SWO_REFERENCED_DATA_NOT_FOUND;
@@ -456,13 +1142,10 @@ end:
  *
  */
 int gpg_apdu_internal_authenticate() {
+    gpg_io_taint();
     // --- PSO:AUTH ---
-    if (G_gpg_vstate.mse_aut->UIF[0]) {
-        if ((G_gpg_vstate.UIF_flags) == 0) {
-            ui_menu_uifconfirm_display(0);
-            return 0;
-        }
-        G_gpg_vstate.UIF_flags = 0;
+    if (!gpg_uif_check(G_gpg_vstate.mse_aut)) {
+        return 0;
     }
 
     if (G_gpg_vstate.mse_aut->attributes.value[0] == KEY_ID_RSA) {
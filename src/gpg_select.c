@@ -55,6 +55,8 @@ int gpg_apdu_select() {
             G_gpg_vstate.verified_pin[3] = 0;
             G_gpg_vstate.verified_pin[4] = 0;
         }
+        gpg_pso_ecdh_cache_clear();
+        gpg_pso_aes_stream_reset();
 
         gpg_io_discard(0);
         if (N_gpg_pstate->histo[HISTO_OFFSET_STATE] != STATE_ACTIVATE) {
@@ -30,10 +30,33 @@
 
 /* big private DO */
 #define GPG_EXT_PRIVATE_DO_LENGTH 512
-/* will be fixed..1024 is not enough */
+/* cardholder certificates are streamed to the NVM heap, see gpg_heap.c */
 #define GPG_EXT_CARD_HOLDER_CERT_LENTH 2560
 /* random choice */
 #define GPG_EXT_CHALLENGE_LENTH 254
+/* NVM heap holding certificates, private DOs, login data and URLs */
+#define GPG_NVM_HEAP_LENGTH 8192
+/* Ledger add-on: bulk put_data container, staged in NVM */
+#define GPG_BULK_MAX_LENGTH 800
+#define GPG_BULK_MAX_DO     32
+/* Ledger add-on: largest challenge, P2 giving the length high byte */
+#define GPG_MAX_CHALLENGE_LENGTH 1024
+/* GET CHALLENGE DRBG reseed interval, in requests */
+#define GPG_DRBG_RESEED_INTERVAL 1024
+
+/* UIF second byte, Ledger add-on: one confirmation opens an approval window
+ * b8-b7: 00 N operations, 01 N x 32 operations, 10 N minutes
+ * b6: general feature (button), b5-b1: N (0 to confirm each operation)
+ */
+#define UIF_WINDOW_N_MASK    0x1F
+#define UIF_WINDOW_UNIT_MASK 0xC0
+#define UIF_WINDOW_OPS       0x00
+#define UIF_WINDOW_OPS32     0x40
+#define UIF_WINDOW_MINUTES   0x80
+/* UX ticker period, in ms: must match the SEPROXYHAL ticker the SDK arms
+ * when initialising IO (100 ms), app_ticker_event_callback() runs on each tick
+ */
+#define UIF_TICKER_PERIOD 100
 /* accept long PW, but less than one sha256 block */
 #define GPG_MAX_PW_LENGTH  12
 #define GPG_MIN_PW1_LENGTH 6
@@ -101,8 +124,7 @@ typedef struct gpg_key_s {
     } pub_key;
     /* C7 C8 C9 , C5 = C7|C8|C9*/
     unsigned char fingerprints[20];
-    /* 7F21 */
-    LV(CA, GPG_EXT_CARD_HOLDER_CERT_LENTH);
+    /* 7F21 is in the NVM heap */
     /* C7 C8 C9, C6 = C7|C8|C9*/
     unsigned char CA_fingerprints[20];
     /* CE CF D0, CD = CE|CF|D0 */
@@ -112,6 +134,10 @@ typedef struct gpg_key_s {
 } gpg_key_t;
 
 typedef struct gpg_key_slot_s {
+    /* install generation, the slot is reinstalled when it differs from the
+     * NVM state one
+     */
+    unsigned int generation;
     unsigned char serial[4];
     /* */
     gpg_key_t sig;
@@ -122,8 +148,7 @@ typedef struct gpg_key_slot_s {
     unsigned int sig_count;
     /* D5 */
     cx_aes_key_t AES_dec;
-    /*  5F50 */
-    LV(url, GPG_EXT_PRIVATE_DO_LENGTH);
+    /*  5F50 is in the NVM heap */
 
 } gpg_key_slot_t;
 
@@ -131,6 +156,26 @@ struct gpg_nv_state_s {
     /* magic */
     unsigned char magic[MAGIC_LENGTH];
 
+    /* 01FD card state counter, bumped by each state change: never reset nor
+     * restored from an archive, so that it is monotonic
+     */
+    unsigned int state_counter;
+
+    /* set while an archive restore is writing, a partial restore can only be
+     * completed by a new restore, or is reset by gpg_init
+     */
+    unsigned int restore_pending;
+
+    /* 01FC bulk container, staged before being applied: gpg_init applies it
+     * again if the application stopped while it was pending
+     */
+    struct {
+        unsigned int pending;
+        unsigned int slot;
+        unsigned int length;
+        unsigned char value[GPG_BULK_MAX_LENGTH];
+    } bulk;
+
     /* pin mode */
     unsigned char config_pin[1];
 
@@ -139,14 +184,7 @@ struct gpg_nv_state_s {
     /* RSA exponent */
     unsigned char default_RSA_exponent[4];
 
-    /*  0101 0102 0103 0104 */
-    LV(private_DO1, GPG_EXT_PRIVATE_DO_LENGTH);
-    LV(private_DO2, GPG_EXT_PRIVATE_DO_LENGTH);
-    LV(private_DO3, GPG_EXT_PRIVATE_DO_LENGTH);
-    LV(private_DO4, GPG_EXT_PRIVATE_DO_LENGTH);
-
-    /*  5E */
-    LV(login, GPG_EXT_PRIVATE_DO_LENGTH);
+    /*  0101 0102 0103 0104, 5E are in the NVM heap */
 
     /* -- Cardholder Related Data -- */
     /*  5B */
@@ -178,11 +216,82 @@ struct gpg_nv_state_s {
     cx_aes_key_t SM_enc;
     /* D2 */
     cx_aes_key_t SM_mac;
+
+    /* install generation, bumped by each reset */
+    unsigned int generation;
+
+    /* NVM heap: variable length DOs, see gpg_heap.c */
+    unsigned int heap_used;
+    /* 1 + offset of the object being removed, 0 when no removal is running */
+    unsigned int heap_moving;
+    unsigned char heap[GPG_NVM_HEAP_LENGTH];
 };
 
 typedef struct gpg_nv_state_s gpg_nv_state_t;
 
-#define GPG_IO_BUFFER_LENGTH (1512)
+/* I/O buffer, also covering the RSA 4096 key pair work structures (multiple of 8) */
+#define GPG_IO_BUFFER_LENGTH (1600)
+
+/* Extended header list (PUT DATA 3FFF) streamed import:
+ * 4D/CRT/7F48/5F48 headers are gathered here, key components go to work area
+ */
+#define GPG_IMPORT_HEADER_LENGTH 64
+#define GPG_IMPORT_MAX_ITEMS     8
+
+/* Device archive (DO 01FA): clear header, then records made of
+ * ciphertext length (2), ciphertext (fragment + 9 bytes, padded) and HMAC (32).
+ * HMACs are chained from the header one
+ */
+#define GPG_ARCHIVE_VERSION         2
+#define GPG_ARCHIVE_HEADER_LENGTH   (4 + 1 + 4 + CX_AES_BLOCK_SIZE)
+#define GPG_ARCHIVE_FRAGMENT_LENGTH 224
+#define GPG_ARCHIVE_RECORD_LENGTH   (2 + GPG_ARCHIVE_FRAGMENT_LENGTH + 16 + 32)
+
+/* NVM heap object: handle (4), length (2), value.
+ * The handle is made of the DO tag, the key slot (HEAP_GLOBAL for DOs not
+ * bound to a slot) and the key attributes tag (C1/C2/C3) for certificates
+ * and public keys.
+ * Public key templates (7F49) are a cache, evicted when room is needed
+ */
+#define HEAP_HEADER_LENGTH              6
+#define HEAP_GLOBAL                     0xFF
+#define HEAP_CACHE_TAG                  0x7F49
+#define HEAP_HANDLE(tag, slot, key)     (((tag) << 16) | ((slot) << 8) | (key))
+#define HEAP_HANDLE_TAG(handle)         ((handle) >> 16)
+#define HEAP_HANDLE_SLOT(handle)        (((handle) >> 8) & 0xFF)
+
+/* ECDH shared secret cache (DO 01FB): entries are tagged with a hash of
+ * the private scalar and of the ephemeral public key
+ */
+#define GPG_ECDH_CACHE_ENTRIES 4
+#define GPG_ECDH_SECRET_LENGTH 66
+
+typedef struct gpg_ecdh_entry_s {
+    unsigned char tag[32];
+    unsigned char secret[GPG_ECDH_SECRET_LENGTH];
+    unsigned char length;
+    unsigned int used;
+} gpg_ecdh_entry_t;
+
+// clang-format off
+typedef enum {
+    ARCHIVE_IDLE = 0,
+    ARCHIVE_HEADER,
+    ARCHIVE_RECORDS,
+    ARCHIVE_DONE,
+    ARCHIVE_ERROR
+} gpg_archive_step_t;
+// clang-format on
+
+// clang-format off
+typedef enum {
+    IMPORT_IDLE = 0,
+    IMPORT_HEADER,
+    IMPORT_DATA,
+    IMPORT_DONE,
+    IMPORT_ERROR
+} gpg_import_step_t;
+// clang-format on
 
 struct gpg_v_state_s {
     /* app state */
@@ -194,6 +303,11 @@ struct gpg_v_state_s {
     unsigned char seed_mode;
 
     unsigned char UIF_flags;
+    /* UIF approval windows of the current slot: sig, dec, aut */
+    struct {
+        unsigned int ops;
+        unsigned int ticks;
+    } uif_window[3];
 
     /* io state*/
 
@@ -207,6 +321,16 @@ struct gpg_v_state_s {
     unsigned short io_offset;
     unsigned short io_mark;
     unsigned short io_p1p2;
+    unsigned char io_stream_in;
+    unsigned char io_stream_out;
+    /* io_buffer extent written since the last clear */
+    unsigned short io_dirty;
+    /* scratch arena size, allocated downward from the io_buffer end */
+    unsigned short scratch_used;
+    /* response range read from NVM, sent as if inserted at io_nvm_at */
+    const unsigned char *io_nvm;
+    unsigned short io_nvm_at;
+    unsigned short io_nvm_length;
     union {
         unsigned char io_buffer[GPG_IO_BUFFER_LENGTH];
         struct {
@@ -240,16 +364,6 @@ struct gpg_v_state_s {
                 cx_ecfp_640_private_key_t private640;
             };
         } ecfp;
-
-        struct {
-            unsigned char md_buffer[GPG_IO_BUFFER_LENGTH -
-                                    (32 + MAX(sizeof(cx_sha3_t), sizeof(cx_sha256_t)))];
-            unsigned char H[32];
-            union {
-                cx_sha3_t sha3;
-                cx_sha256_t sha256;
-            };
-        } md;
     } work;
 
     /* data state */
@@ -257,6 +371,97 @@ struct gpg_v_state_s {
     unsigned short DO_reccord;
     unsigned short DO_offset;
 
+    /* streamed operations states, only one runs at a time:
+     * each one is cleared when its command starts
+     */
+    union {
+        /* batch PSO state */
+        struct {
+            gpg_key_t *key;
+            unsigned short mark;
+            unsigned short offset;
+            unsigned short end;
+            unsigned short count;
+        } batch;
+
+        /* key import state (PUT DATA 3FFF) */
+        struct {
+            unsigned char step;
+            unsigned char nb_items;
+            unsigned char item;
+            unsigned char hdr_length;
+            unsigned char options;
+            unsigned short items;
+            unsigned short sw;
+            unsigned short item_offset;
+            unsigned int ksz;
+            gpg_key_t *keygpg;
+            unsigned char *target;
+            unsigned char e[4];
+            unsigned char tags[GPG_IMPORT_MAX_ITEMS];
+            unsigned short lengths[GPG_IMPORT_MAX_ITEMS];
+            unsigned char header[GPG_IMPORT_HEADER_LENGTH];
+        } import;
+
+        /* streamed NVM heap object write (PUT DATA 7F21) */
+        struct {
+            unsigned int handle;
+            unsigned short length;
+            unsigned short max;
+            unsigned short sw;
+        } heap_stream;
+
+        /* device archive state (DO 01FA) */
+        struct {
+            unsigned char step;
+            unsigned char region;
+            unsigned short sw;
+            unsigned short seq;
+            unsigned short rec_length;
+            unsigned short rec_offset;
+            /* write pass: records are applied, not only authenticated */
+            unsigned char apply;
+            unsigned int offset;
+            unsigned char iv[CX_AES_BLOCK_SIZE];
+            unsigned char mac_key[32];
+            unsigned char chain[CX_SHA256_SIZE];
+            cx_aes_key_t key;
+        } archive;
+    };
+
+    /* archive fully authenticated by the last check pass (DO 01FA), identified
+     * by its initial IV: the next restore of the same archive applies it
+     */
+    struct {
+        unsigned char valid;
+        unsigned char iv[CX_AES_BLOCK_SIZE];
+    } archive_checked;
+
+    /* GET CHALLENGE HMAC-DRBG, instantiated on first use */
+    struct {
+        unsigned char K[32];
+        unsigned char V[32];
+        unsigned int reseed_counter;
+        /* seeded mode: hash state after the derived secret */
+        cx_sha256_t seeded;
+        unsigned char seeded_ready;
+    } drbg;
+
+    /* AES-CBC stream (PSO_ENC_STREAM / PSO_DEC_STREAM) */
+    struct {
+        unsigned short mode;
+        unsigned char iv[CX_AES_BLOCK_SIZE];
+    } aes_stream;
+
+    /* ECDH shared secret cache, disabled when size is 0 */
+    struct {
+        unsigned char size;
+        unsigned int clock;
+        unsigned int hits;
+        unsigned int misses;
+        gpg_ecdh_entry_t entries[GPG_ECDH_CACHE_ENTRIES];
+    } ecdh_cache;
+
     /* PINs state */
     unsigned char verified_pin[5];
     unsigned char pinmode;
@@ -271,7 +476,6 @@ struct gpg_v_state_s {
 
     char line[112];
     unsigned int ux_step;
-    nbgl_layout_t *layoutCtx;
 
 #ifdef GPG_LOG
     unsigned char log_buffer[256];
@@ -327,6 +531,7 @@ typedef enum {
 #define INS_SELECT_DATA           0xa5
 #define INS_GET_RESPONSE          0xc0
 #define INS_GET_DATA              0xca
+#define INS_GET_DATA_ODD          0xcb
 #define INS_GET_NEXT_DATA         0xcc
 #define INS_PUT_DATA              0xda
 #define INS_PUT_DATA_ODD          0xdb
@@ -337,9 +542,23 @@ typedef enum {
 #define SEEDED_MODE           0x01
 #define GEN_ASYM_KEY_SEED     (GEN_ASYM_KEY | SEEDED_MODE)
 #define READ_ASYM_KEY         0x8100
+/* Ledger add-on: generate then store the fingerprint and date, P2 flags */
+#define COMMIT_MODE    0x02
+#define COMMIT_V5_MODE 0x04
+/* Ledger add-on: seeded generation of all keys of a set of slots */
+#define GEN_ASYM_KEY_PROVISION 0x8200
 #define PSO_CDS               0x9e9a
 #define PSO_DEC               0x8086
 #define PSO_ENC               0x8680
+/* Ledger add-on: batch of PSO */
+#define PSO_CDS_BATCH 0x9e00
+#define PSO_DEC_BATCH 0x8000
+/* Ledger add-on: AES-CBC stream, P2 low bits are PSO_STREAM_xx flags */
+#define PSO_ENC_STREAM   0x8610
+#define PSO_DEC_STREAM   0x8010
+#define PSO_STREAM_MASK  0xFFFC
+#define PSO_STREAM_FIRST 0x01
+#define PSO_STREAM_LAST  0x02
 #define MSE_SET               0x41
 #define GET_RESPONSE          0x00
 #define PIN_NOT_VERIFIED      0xFF
@@ -34,10 +34,7 @@ void ui_CCID_reset(void) {
  *
  */
 void app_reset(void) {
-    unsigned char magic[MAGIC_LENGTH];
-
-    explicit_bzero(magic, MAGIC_LENGTH);
-    nvm_write((void*) (N_gpg_pstate->magic), magic, MAGIC_LENGTH);
+    gpg_install(STATE_ACTIVATE);
     gpg_init();
     ui_CCID_reset();
 }
@@ -262,7 +262,8 @@ static void slot_cb(int token, uint8_t index) {
         case TOKEN_SLOT_SELECT:
             if (index != G_gpg_vstate.slot) {
                 G_gpg_vstate.slot = index;
-                G_gpg_vstate.kslot = (gpg_key_slot_t*) &N_gpg_pstate->keys[G_gpg_vstate.slot];
+                G_gpg_vstate.kslot = gpg_install_slot_get(G_gpg_vstate.slot);
+                gpg_state_counter_bump();
                 gpg_mse_reset();
                 ui_CCID_reset();
 #ifdef SCREEN_SIZE_NANO
@@ -273,6 +274,7 @@ static void slot_cb(int token, uint8_t index) {
             break;
         case TOKEN_SLOT_DEF:
             nvm_write((void*) (&N_gpg_pstate->config_slot[1]), &G_gpg_vstate.slot, 1);
+            gpg_state_counter_bump();
             ui_menu_slot_action();
             break;
         default:
@@ -585,8 +587,9 @@ static void template_key_cb(int token, uint8_t index, int page) {
 
         if (dest && attributes.value[0] &&
             memcmp(&dest->attributes, &attributes, sizeof(attributes)) != 0) {
-            nvm_write(dest, NULL, sizeof(gpg_key_t));
+            gpg_install_key_invalidate(dest);
             nvm_write(&dest->attributes, &attributes, sizeof(attributes));
+            gpg_state_counter_bump();
         }
     }
     ui_settings_template();
@@ -1018,27 +1021,30 @@ _Static_assert(SWITCH_UIF_NB < ARRAYLEN(switches), "Too small switches array");
  */
 static void uif_cb(int token, uint8_t index, int page) {
     UNUSED(page);
-    uint8_t* uif = NULL;
+    gpg_key_t* key = NULL;
 
     switch (token) {
         case TOKEN_UIF_SIG:
-            uif = &G_gpg_vstate.kslot->sig.UIF[0];
+            key = &G_gpg_vstate.kslot->sig;
             break;
         case TOKEN_UIF_DEC:
-            uif = &G_gpg_vstate.kslot->dec.UIF[0];
+            key = &G_gpg_vstate.kslot->dec;
             break;
         case TOKEN_UIF_AUT:
-            uif = &G_gpg_vstate.kslot->aut.UIF[0];
+            key = &G_gpg_vstate.kslot->aut;
             break;
     }
-    if (uif == NULL) {
+    if (key == NULL) {
         return;
     }
-    if (uif[0] == 2) {
+    if (key->UIF[0] == 2) {
         ui_info(UIF_LOCKED, EMPTY, ui_home_init, false);
         return;
     }
-    nvm_write(&uif[0], &index, 1);
+    nvm_write(&key->UIF[0], &index, 1);
+    gpg_state_counter_bump();
+    // toggling the flag revokes the current approval window
+    gpg_pso_uif_reset(key);
 
     switches[token - FIRST_USER_TOKEN].initState = index;
 }
@@ -1378,23 +1384,39 @@ void uif_confirm_cb(bool confirm) {
  */
 void ui_menu_uifconfirm_display(unsigned int value) {
     UNUSED(value);
+    const gpg_key_t* key = NULL;
+    unsigned int len, n;
 
     switch (G_gpg_vstate.io_ins) {
         case INS_INTERNAL_AUTHENTICATE:
             snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Authentication");
+            key = G_gpg_vstate.mse_aut;
             break;
         case INS_PSO:
             switch (G_gpg_vstate.io_p1p2) {
                 case PSO_CDS:
+                case PSO_CDS_BATCH:
                     snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Signature");
+                    key = &G_gpg_vstate.kslot->sig;
                     break;
                 case PSO_ENC:
                     snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Encryption");
+                    key = G_gpg_vstate.mse_dec;
                     break;
                 case PSO_DEC:
+                case PSO_DEC_BATCH:
                     snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Decryption");
+                    key = G_gpg_vstate.mse_dec;
                     break;
                 default:
+                    // AES streams
+                    if ((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_ENC_STREAM) {
+                        snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Encryption");
+                        key = G_gpg_vstate.mse_dec;
+                    } else if ((G_gpg_vstate.io_p1p2 & PSO_STREAM_MASK) == PSO_DEC_STREAM) {
+                        snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Decryption");
+                        key = G_gpg_vstate.mse_dec;
+                    }
                     break;
             }
             break;
@@ -1403,6 +1425,28 @@ void ui_menu_uifconfirm_display(unsigned int value) {
     }
     if (G_gpg_vstate.menu[0] == 0) {
         snprintf(G_gpg_vstate.menu, sizeof(G_gpg_vstate.menu), "Please Cancel");
+    } else if ((key != NULL) && ((n = key->UIF[1] & UIF_WINDOW_N_MASK) != 0)) {
+        // show the approval window opened by this confirmation
+        len = strlen(G_gpg_vstate.menu);
+        switch (key->UIF[1] & UIF_WINDOW_UNIT_MASK) {
+            case UIF_WINDOW_OPS:
+                snprintf(G_gpg_vstate.menu + len, sizeof(G_gpg_vstate.menu) - len, "\nx%d", n);
+                break;
+            case UIF_WINDOW_OPS32:
+                snprintf(G_gpg_vstate.menu + len,
+                         sizeof(G_gpg_vstate.menu) - len,
+                         "\nx%d",
+                         n * 32);
+                break;
+            case UIF_WINDOW_MINUTES:
+                snprintf(G_gpg_vstate.menu + len,
+                         sizeof(G_gpg_vstate.menu) - len,
+                         "\nfor %d min",
+                         n);
+                break;
+            default:
+                break;
+        }
     }
     nbgl_useCaseChoice(NULL, "Confirm operation", G_gpg_vstate.menu, "Yes", "No", uif_confirm_cb);
 }
@@ -19,4 +19,11 @@
 
 gpg_v_state_t G_gpg_vstate;
 
+// wiping the I/O buffer must also wipe the key structures it overlays
+_Static_assert(sizeof(G_gpg_vstate.work) == GPG_IO_BUFFER_LENGTH,
+               "Key work structures exceed the I/O buffer");
+// a full command, a full response and the signature scratch area must fit
+_Static_assert(GPG_IO_BUFFER_LENGTH >= 4 * GPG_APDU_LENGTH + 256, "Too small I/O buffer");
+_Static_assert(GPG_IO_BUFFER_LENGTH < 0xFFFF, "I/O offsets are 16 bits");
+
 const gpg_nv_state_t N_state_pic;
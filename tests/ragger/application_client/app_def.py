@@ -26,6 +26,7 @@ class InsType(IntEnum):
     INS_CHANGE_REF_DATA  = 0x24
     INS_RESET_RC         = 0x2C
     INS_GET_DATA         = 0xCA
+    INS_GET_DATA_ODD     = 0xCB
     INS_PUT_DATA         = 0xDA
     INS_GEN_ASYM_KEYPAIR = 0x47
     INS_GET_RESPONSE     = 0xC0
@@ -123,6 +124,9 @@ class DataObject(IntEnum):
     # [Write] AES symmetric key
     DO_KEY_AES = 0xD5
 
+    # [Read/Write] PW Status Bytes
+    DO_PW_STATUS = 0xC4
+
     # [Read/Write] User Interaction Flag (UIF) for PSO:CDS
     DO_UIF_SIG = 0xD6
     # [Read/Write] User Interaction Flag (UIF) for PSO:DEC
@@ -132,11 +136,23 @@ class DataObject(IntEnum):
 
     # [Read/Write] Asymmetric Key Pair
     DO_PUB_KEY = 0x7F49
+    # [Read/Write] Cardholder certificate
+    DO_CERT = 0x7F21
 
     # [Read/Write] Slot config
     CMD_SLOT_CFG = 0x01F1
     # [Read/Write] Slot selection
     CMD_SLOT_CUR = 0x01F2
+    # [Read/Write] Encrypted device archive
+    CMD_ARCHIVE = 0x01FA
+    # [Read/Write] ECDH secret cache
+    CMD_ECDH_CACHE = 0x01FB
+    # [Write] Bulk container of Data Objects
+    CMD_BULK_DATA = 0x01FC
+    # [Read] Card state counter
+    CMD_STATE_COUNTER = 0x01FD
+    # [Write] Extended Header list: private key import
+    CMD_KEY_IMPORT = 0x3FFF
 
     # [Read/Write] Language preferences (according to ISO 639)
     DO_CARD_LANG = 0x5F2D
@@ -5,7 +5,7 @@
 This module provides Ragger tests Client application.
 It contains the command sending part.
 """
-from typing import Generator, Optional, Tuple
+from typing import Generator, List, Optional, Tuple
 from contextlib import contextmanager
 
 import binascii
@@ -89,6 +89,16 @@ class CommandSender:
 
         p1 = 0x00 if tag <= 0xFF else (tag >> 8) & 0xFF
         p2 = tag & 0xFF
+        # Longer data uses Chaining mode APDU
+        while len(data) > 254:
+            cla = ClaType.CLA_APP_CHAIN
+            frame = bytes.fromhex(f"{cla:02x}{InsType.INS_PUT_DATA:02x}{p1:02x}{p2:02x}fe")
+            try:
+                self.backend.exchange_raw(frame + data[:254])
+            except ExceptionRAPDU as err:
+                return RAPDU(err.status, err.data)
+            data = data[254:]
+
         return self.backend.exchange(cla=ClaType.CLA_APP,
                                     ins=InsType.INS_PUT_DATA,
                                     p1=p1,
@@ -96,6 +106,52 @@ class CommandSender:
                                     data=data)
 
 
+    def get_data_slice(self, tag: DataObject, offset: Optional[int] = None, size: int = 0) -> RAPDU:
+        """APDU Get Data, odd instruction: read a slice of a Data Object
+
+        Args:
+            tag (DataObject): Tag identifying the data to process
+            offset (int):     Slice offset, None to continue after the previous slice
+            size (int):       Slice length, 0 up to the end
+
+        Returns:
+            Response APDU
+        """
+
+        cla = ClaType.CLA_APP
+        ins = InsType.INS_GET_DATA_ODD
+        p1 = 0x00 if tag <= 0xFF else (tag >> 8) & 0xFF
+        p2 = tag & 0xFF
+        data = bytes([cla, ins, p1, p2])
+        if offset is not None:
+            data += bytes([4, 0x54, 2]) + offset.to_bytes(2, "big")
+        data += size.to_bytes(1, "big")
+        try:
+            rapdu = self.backend.exchange_raw(data)
+        except ExceptionRAPDU as err:
+            rapdu = RAPDU(err.status, err.data)
+
+        # Receive long response
+        return self.get_long_response(rapdu)
+
+
+    def get_archive(self) -> RAPDU:
+        """APDU Get Data: backup the encrypted device archive
+
+        Returns:
+            Response APDU
+        """
+
+        data = bytes([ClaType.CLA_APP, InsType.INS_GET_DATA, 0x01, 0xFA, 0x00])
+        try:
+            rapdu = self.backend.exchange_raw(data)
+        except ExceptionRAPDU as err:
+            rapdu = RAPDU(err.status, err.data)
+
+        # Receive long response
+        return self.get_long_response(rapdu)
+
+
     ############### SLOT interface ###############
     def get_slot(self) -> int:
         """APDU Get Slot
@@ -283,8 +339,10 @@ class CommandSender:
 
         cla = ClaType.CLA_APP
         ins = InsType.INS_GET_CHALLENGE
-        Le = f"{size:02x}" if size < 255 else f"{size:04x}"
-        data = bytes.fromhex(f"{cla:02x}{ins:02x}0000{Le}")
+        # Ledger add-on: P2 is the length high byte
+        p2 = (size >> 8) & 0xFF
+        Le = size & 0xFF
+        data = bytes.fromhex(f"{cla:02x}{ins:02x}00{p2:02x}{Le:02x}")
         try:
             rapdu = self.backend.exchange_raw(data)
         except ExceptionRAPDU as err:
@@ -321,6 +379,62 @@ class CommandSender:
         return self.__key(0x80, key, seed)
 
 
+    def generate_key_commit(self, key: DataObject, timestamp: int, v5: bool = False) -> RAPDU:
+        """APDU Generate Asymmetric Key pair, then store its fingerprint and date
+
+        Args:
+            key (DataObject): Tag identifying the key to process
+            timestamp (int):  Key creation time
+            v5 (bool):        Compute a v5 fingerprint instead of a v4 one
+
+        Returns:
+            Response APDU
+        """
+
+        data = bytes.fromhex(f"{key:02x}00") + timestamp.to_bytes(4, "big")
+        p2 = 0x06 if v5 else 0x02
+        try:
+            rapdu = self.backend.exchange(cla=ClaType.CLA_APP,
+                                  ins=InsType.INS_GEN_ASYM_KEYPAIR,
+                                  p1=0x80,
+                                  p2=p2,
+                                  data=data)
+        except ExceptionRAPDU as err:
+            rapdu = RAPDU(err.status, err.data)
+
+        # Receive long response
+        return self.get_long_response(rapdu)
+
+
+    def provision_keys(self, slots: int, timestamp: Optional[int] = None, v5: bool = False) -> RAPDU:
+        """APDU Generate Asymmetric Key pair, all keys of a set of slots in seed mode
+
+        Args:
+            slots (int):      Bit mask of the slots to provision
+            timestamp (int):  Key creation time, to also store fingerprints and dates
+            v5 (bool):        Compute v5 fingerprints instead of v4 ones
+
+        Returns:
+            Response APDU, with the status of each key: slot, CRT tag, Status Word
+        """
+
+        data = slots.to_bytes(1, "big")
+        p2 = 0x00
+        if timestamp is not None:
+            data += timestamp.to_bytes(4, "big")
+            p2 = 0x06 if v5 else 0x02
+        try:
+            rapdu = self.backend.exchange(cla=ClaType.CLA_APP,
+                                  ins=InsType.INS_GEN_ASYM_KEYPAIR,
+                                  p1=0x82,
+                                  p2=p2,
+                                  data=data)
+        except ExceptionRAPDU as err:
+            rapdu = RAPDU(err.status, err.data)
+
+        return rapdu
+
+
     def authenticate(self, frame: bytes) -> RAPDU:
         """APDU Internal Authenticate
 
@@ -345,6 +459,36 @@ class CommandSender:
 
         return self.__pso(InsType.INS_PSO, 0x9e9a, frame)
 
+    @contextmanager
+    def sign_with_confirmation(self, frame: bytes) -> Generator[None, None, None]:
+        """APDU Sign - with UIF confirmation
+
+        Args:
+            frame (bytes): Data to process
+
+        Returns:
+            Response APDU
+        """
+
+        with self.backend.exchange_async(cla=ClaType.CLA_APP,
+                                         ins=InsType.INS_PSO,
+                                         p1=0x9e,
+                                         p2=0x9a,
+                                         data=frame) as response:
+            yield response
+
+    def sign_batch(self, frames: List[bytes]) -> RAPDU:
+        """APDU Sign a batch of data
+
+        Args:
+            frames (List[bytes]): Data to process, each one signed separately
+
+        Returns:
+            Response APDU, with each signature prefixed by its length (2 bytes)
+        """
+
+        return self.__pso(InsType.INS_PSO, 0x9e00, self.__batch(frames))
+
     def encrypt(self, frame: bytes) -> RAPDU:
         """APDU Encipher
 
@@ -357,6 +501,26 @@ class CommandSender:
 
         return self.__pso(InsType.INS_PSO, 0x8680, frame)
 
+    def aes_stream(self, frame: bytes, encrypt: bool, first: bool, last: bool) -> RAPDU:
+        """APDU Encipher or Decipher one part of an AES-CBC stream
+
+        Args:
+            frame (bytes):  Data to process, a whole number of AES blocks
+            encrypt (bool): Encipher, or Decipher
+            first (bool):   First part of the stream
+            last (bool):    Last part of the stream
+
+        Returns:
+            Response APDU
+        """
+
+        tag = 0x8610 if encrypt else 0x8010
+        if first:
+            tag |= 0x01
+        if last:
+            tag |= 0x02
+        return self.__pso(InsType.INS_PSO, tag, frame)
+
     def decrypt(self, frame: bytes) -> RAPDU:
         """APDU Decipher
 
@@ -369,6 +533,29 @@ class CommandSender:
 
         return self.__pso(InsType.INS_PSO, 0x8086, frame)
 
+    def decrypt_batch(self, frames: List[bytes]) -> RAPDU:
+        """APDU Decipher a batch of cryptograms with the decryption key
+
+        Args:
+            frames (List[bytes]): Cryptograms, each with its Padding Indicator
+
+        Returns:
+            Response APDU, with each plain data prefixed by its length (2 bytes)
+        """
+
+        frame = self.__batch(frames)
+        # Longer batch uses Chaining mode APDU
+        while len(frame) > 254:
+            cla = ClaType.CLA_APP_CHAIN
+            data = bytes.fromhex(f"{cla:02x}{InsType.INS_PSO:02x}8000fe") + frame[:254]
+            try:
+                self.backend.exchange_raw(data)
+            except ExceptionRAPDU as err:
+                return RAPDU(err.status, err.data)
+            frame = frame[254:]
+
+        return self.__pso(InsType.INS_PSO, 0x8000, frame)
+
     def decrypt_asym(self, frame: bytes, algo: PubkeyAlgo = PubkeyAlgo.RSA) -> RAPDU:
         """APDU Decipher with RSA
 
@@ -489,6 +676,19 @@ class CommandSender:
         return self.get_long_response(rapdu)
 
 
+    def __batch(self, frames: List[bytes]) -> bytes:
+        """Encode a batch of items, each prefixed by its length (2 bytes)
+
+        Args:
+            frames (List[bytes]): Items to encode
+
+        Returns:
+            Encoded batch
+        """
+
+        return b"".join(len(f).to_bytes(2, "big") + f for f in frames)
+
+
     def __key(self, p1: int, key: DataObject, seed: bool = False) -> RAPDU:
         """APDU Asymmetric Key pair
 
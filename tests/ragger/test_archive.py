@@ -0,0 +1,80 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the device archive
+"""
+import pytest
+
+from ragger.backend import BackendInterface
+from ragger.error import ExceptionRAPDU
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode
+
+# Clear header: target ID (4), version (1), state size (4), IV (16)
+HEADER_LENGTH = 25
+
+
+def test_archive_header(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.put_data(DataObject.DO_URL, b"https://archive.example")
+    assert rapdu.status == Errors.SW_OK
+
+    rapdu = client.get_archive()
+    assert rapdu.status == Errors.SW_OK
+    archive = rapdu.data
+    assert len(archive) > HEADER_LENGTH
+
+    # Changed after the backup: check passes must leave it unchanged
+    rapdu = client.put_data(DataObject.DO_URL, b"https://changed.example")
+    assert rapdu.status == Errors.SW_OK
+
+    # A modified IV changes the first record plaintext: the header is authenticated
+    tampered = bytearray(archive)
+    tampered[9] ^= 0x01
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_ARCHIVE, bytes(tampered))
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+    # Records can not be dropped either
+    first = HEADER_LENGTH + 2 + int.from_bytes(archive[HEADER_LENGTH:HEADER_LENGTH + 2], "big") + 32
+    second = first + 2 + int.from_bytes(archive[first:first + 2], "big") + 32
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_ARCHIVE, archive[:first] + archive[second:])
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+    # Nor the end record
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_ARCHIVE, archive[:second])
+    assert err.value.status == Errors.SW_WRONG_LENGTH
+
+    # Failed check passes wrote nothing
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.data == b"https://changed.example"
+
+    # The genuine archive is checked first, without being applied
+    rapdu = client.put_data(DataObject.CMD_ARCHIVE, archive)
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.data == b"https://changed.example"
+
+    # An interrupted write pass leaves the restore pending
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_ARCHIVE, archive[:second])
+    assert err.value.status == Errors.SW_WRONG_LENGTH
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.get_data(DataObject.DO_URL)
+    assert err.value.status == Errors.SW_CONDITIONS_NOT_SATISFIED
+
+    # The checked archive is sent again to complete the restore
+    rapdu = client.put_data(DataObject.CMD_ARCHIVE, archive)
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.data == b"https://archive.example"
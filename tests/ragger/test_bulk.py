@@ -0,0 +1,63 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the bulk PUT DATA feature
+"""
+import pytest
+
+from ragger.backend import BackendInterface
+from ragger.error import ExceptionRAPDU
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode
+
+
+def _bulk(*dos: tuple) -> bytes:
+    """Build a bulk container from (tag, value) pairs"""
+
+    data = b""
+    for tag, value in dos:
+        data += tag.to_bytes(2, "big") + len(value).to_bytes(1, "big") + value
+    return data
+
+
+def test_bulk_put(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Write several DO at once
+    data = _bulk((DataObject.DO_CARD_NAME, b"Doe<<John"),
+                 (DataObject.DO_CARD_LANG, b"fr"),
+                 (DataObject.DO_URL, b"https://bulk.example"))
+    rapdu = client.put_data(DataObject.CMD_BULK_DATA, data)
+    assert rapdu.status == Errors.SW_OK
+
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == b"https://bulk.example"
+    rapdu = client.get_data(DataObject.DO_CARDHOLDER_DATA)
+    assert rapdu.status == Errors.SW_OK
+    assert b"Doe<<John" in rapdu.data
+
+    # A wrong value rejects the whole container
+    data = _bulk((DataObject.DO_URL, b"https://other.example"),
+                 (DataObject.DO_SIG_ATTR, b"\x01\x12\x34"))
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_BULK_DATA, data)
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == b"https://bulk.example"
+
+    # PIN DO are not accepted
+    data = _bulk((0xD3, b"12345678"))
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_BULK_DATA, data)
+    assert err.value.status == Errors.SW_REFERENCED_DATA_NOT_FOUND
@@ -5,7 +5,7 @@
 This module provides Ragger tests for Cipher feature
 """
 from Crypto.Random import get_random_bytes
-from Crypto.Cipher import PKCS1_v1_5
+from Crypto.Cipher import AES, PKCS1_v1_5
 from Crypto.PublicKey import ECC
 from Crypto.Protocol.DH import key_agreement
 
@@ -18,6 +18,20 @@ from utils import check_pincode, generate_key, get_RSA_pub_key
 from utils import get_ECDH_pub_key, KEY_TEMPLATES
 
 
+# Build the PSO:DEC ECDH template for an ephemeral key
+def _ecdh_payload(privkey: ECC.EccKey) -> bytes:
+    pubkey2 = privkey.public_key()
+    exp_pubkey = pubkey2.export_key(format="raw", compress="True")
+    payload_len = len(exp_pubkey)
+    hdr1 = payload_len.to_bytes(1, byteorder='big')
+    hdr2 = bytes.fromhex("86") + hdr1 # tag_PubKey_ext
+    payload_len += 2
+    hdr3 = bytes.fromhex("7f49") + payload_len.to_bytes(1, byteorder='big') + hdr2  # tag_PubKey_D0
+    payload_len += 3
+    hdr = payload_len.to_bytes(1, byteorder='big') + hdr3
+    return hdr + exp_pubkey
+
+
 # In this test we check the symmetric key encryption
 def test_AES(backend: BackendInterface) -> None:
     # Use the app interface instead of raw interface
@@ -46,6 +60,52 @@ def test_AES(backend: BackendInterface) -> None:
     assert rapdu.data == plain
 
 
+# In this test we check the AES-CBC stream
+def test_AES_stream(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    key = get_random_bytes(32)
+    # Store the AES Key
+    rapdu = client.put_data(DataObject.DO_KEY_AES, key)
+    assert rapdu.status == Errors.SW_OK
+
+    # Verify PW2 (User)
+    check_pincode(client, PassWord.PW2)
+
+    # Encrypt the data in 3 parts
+    plain = get_random_bytes(3 * 64)
+    ciphertext = b""
+    for i in range(3):
+        rapdu = client.aes_stream(plain[i * 64:(i + 1) * 64], True, i == 0, i == 2)
+        assert rapdu.status == Errors.SW_OK
+        ciphertext += rapdu.data
+    # The random IV comes first
+    iv = ciphertext[:16]
+    assert ciphertext[16:] == AES.new(key, AES.MODE_CBC, iv=iv).encrypt(plain)
+
+    # Each stream gets its own IV
+    rapdu = client.aes_stream(plain[:64], True, True, True)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data[:16] != iv
+
+    # A part without an ongoing stream is rejected
+    rapdu = client.aes_stream(ciphertext[:16], False, False, False)
+    assert rapdu.status == Errors.SW_CONDITIONS_NOT_SATISFIED
+
+    # Decrypt the data in 2 parts, the IV first
+    rapdu = client.aes_stream(ciphertext[:80], False, True, False)
+    assert rapdu.status == Errors.SW_OK
+    data = rapdu.data
+    rapdu = client.aes_stream(ciphertext[80:], False, False, True)
+    assert rapdu.status == Errors.SW_OK
+    data += rapdu.data
+    assert data == plain
+
+
 # In this test we check the symmetric key encryption
 def test_Asym(backend: BackendInterface) -> None:
     # Use the app interface instead of raw interface
@@ -72,6 +132,37 @@ def test_Asym(backend: BackendInterface) -> None:
     assert rapdu.data == plain
 
 
+# In this test we check the batch decryption
+def test_Asym_batch(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Generate the DEC Key Pair
+    generate_key(client, DataObject.DO_DEC_KEY)
+
+    # Verify PW2 (User)
+    check_pincode(client, PassWord.PW2)
+
+    # Read the DEC pub Key
+    pubkey = get_RSA_pub_key(client, DataObject.DO_DEC_KEY)
+
+    # Encrypt random session keys with Pub Key
+    plains = [get_random_bytes(32) for _ in range(2)]
+    cipher = PKCS1_v1_5.new(pubkey)
+    ciphertexts = [b"\x00" + cipher.encrypt(plain) for plain in plains]
+
+    # Decrypt all the data with the Private key
+    rapdu = client.decrypt_batch(ciphertexts)
+    assert rapdu.status == Errors.SW_OK
+
+    data = rapdu.data
+    for plain in plains:
+        size = int.from_bytes(data[:2], "big")
+        assert data[2:2 + size] == plain
+        data = data[2 + size:]
+    assert len(data) == 0
+
+
 # In this test we check the symmetric key encryption with MSE
 def test_MSE(backend: BackendInterface) -> None:
     # Use the app interface instead of raw interface
@@ -127,15 +218,44 @@ def test_cv25519(backend: BackendInterface) -> None:
     expected_secret = key_agreement(static_priv=privkey, static_pub=pubkey, kdf=lambda x:x)
 
     # Compute ecdh
-    pubkey2 = privkey.public_key()
-    exp_pubkey = pubkey2.export_key(format="raw", compress="True")
-    payload_len = len(exp_pubkey)
-    hdr1 = payload_len.to_bytes(1, byteorder='big')
-    hdr2 = bytes.fromhex("86") + hdr1 # tag_PubKey_ext
-    payload_len += 2
-    hdr3 = bytes.fromhex("7f49") + payload_len.to_bytes(1, byteorder='big') + hdr2  # tag_PubKey_D0
-    payload_len += 3
-    hdr = payload_len.to_bytes(1, byteorder='big') + hdr3
-    secret = client.decrypt_asym(hdr + exp_pubkey, PubkeyAlgo.ECDH).data
+    secret = client.decrypt_asym(_ecdh_payload(privkey), PubkeyAlgo.ECDH).data
 
     assert secret == expected_secret
+
+
+# In this test we check the ECDH secret cache
+def test_cv25519_cache(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Set dec key template
+    rapdu = client.set_template(DataObject.DO_DEC_ATTR, KEY_TEMPLATES["cv25519"])
+    assert rapdu.status == Errors.SW_OK
+
+    # Generate the DEC Key Pair
+    generate_key(client, DataObject.DO_DEC_KEY)
+
+    # Verify PW2 (User)
+    check_pincode(client, PassWord.PW2)
+
+    # Enable the cache
+    rapdu = client.put_data(DataObject.CMD_ECDH_CACHE, b"\x02")
+    assert rapdu.status == Errors.SW_OK
+
+    # Read the DEC pub Key
+    pubkey = get_ECDH_pub_key(client, DataObject.DO_DEC_KEY)
+
+    # Decrypt twice with the same ephemeral key, then with another one
+    privkeys = [ECC.generate(curve="Curve25519") for _ in range(2)]
+    for privkey in (privkeys[0], privkeys[0], privkeys[1]):
+        expected_secret = key_agreement(static_priv=privkey, static_pub=pubkey, kdf=lambda x:x)
+        secret = client.decrypt_asym(_ecdh_payload(privkey), PubkeyAlgo.ECDH).data
+        assert secret == expected_secret
+
+    # Check counters
+    rapdu = client.get_data(DataObject.CMD_ECDH_CACHE)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == bytes.fromhex("02" + "00000001" + "00000002")
@@ -0,0 +1,177 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the streamed key import feature
+"""
+from typing import List, Optional, Tuple
+import pytest
+
+from Crypto.Hash import SHA256
+from Crypto.PublicKey import RSA, ECC
+from Crypto.Random import get_random_bytes
+from Crypto.Signature import pkcs1_15
+from Crypto.Util.number import long_to_bytes
+
+from ragger.backend import BackendInterface
+from ragger.error import ExceptionRAPDU
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode, get_RSA_pub_key, get_ECDSA_pub_key
+from utils import KEY_TEMPLATES, SHA256_DIGEST_INFO
+
+# Ledger add-on: import options DO, inside the CRT
+IMPORT_OPTIONS_TAG = b"\xdf\x01"
+IMPORT_CHECK_PUBLIC = 0x01
+
+
+def _length(size: int) -> bytes:
+    if size < 0x80:
+        return bytes([size])
+    if size < 0x100:
+        return bytes([0x81, size])
+    return bytes([0x82]) + size.to_bytes(2, "big")
+
+
+def _tlv(tag: bytes, value: bytes) -> bytes:
+    return tag + _length(len(value)) + value
+
+
+def _header_list(crt: int, items: List[Tuple[int, bytes]], options: Optional[int] = None) -> bytes:
+    """Build an Extended Header list (4D): CRT, 7F48 template and 5F48 components"""
+
+    content = b"" if options is None else _tlv(IMPORT_OPTIONS_TAG, bytes([options]))
+    template = b"".join(bytes([tag]) + _length(len(value)) for tag, value in items)
+    components = b"".join(value for _, value in items)
+    data = _tlv(bytes([crt]), content)
+    data += _tlv(b"\x7f\x48", template)
+    data += _tlv(b"\x5f\x48", components)
+    return _tlv(b"\x4d", data)
+
+
+def _rsa_header_list(key: RSA.RsaKey, modulus: bool = True) -> bytes:
+    items = [(0x91, long_to_bytes(key.e)),
+             (0x92, long_to_bytes(key.p, 128)),
+             (0x93, long_to_bytes(key.q, 128))]
+    if modulus:
+        items.append((0x97, long_to_bytes(key.n, 256)))
+    return _header_list(DataObject.DO_SIG_KEY, items)
+
+
+def _ecc_header_list(key: ECC.EccKey, point: ECC.EccPoint, options: Optional[int]) -> bytes:
+    items = [(0x92, long_to_bytes(int(key.d), 32)),
+             (0x99, b"\x04" + long_to_bytes(int(point.x), 32) + long_to_bytes(int(point.y), 32))]
+    return _header_list(DataObject.DO_SIG_KEY, items, options)
+
+
+def test_import_rsa(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    key = RSA.generate(2048)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.set_template(DataObject.DO_SIG_ATTR, KEY_TEMPLATES["rsa2048"])
+    assert rapdu.status == Errors.SW_OK
+
+    # e, p, q and the modulus, streamed over chained commands
+    rapdu = client.put_data(DataObject.CMD_KEY_IMPORT, _rsa_header_list(key))
+    assert rapdu.status == Errors.SW_OK
+    pubkey = get_RSA_pub_key(client, DataObject.DO_SIG_KEY)
+    assert pubkey.n == key.n
+    assert pubkey.e == key.e
+
+    # The private exponent is right
+    check_pincode(client, PassWord.PW1)
+    hash_obj = SHA256.new(get_random_bytes(16))
+    rapdu = client.sign(SHA256_DIGEST_INFO + hash_obj.digest())
+    assert rapdu.status == Errors.SW_OK
+    pkcs1_15.new(pubkey).verify(hash_obj, rapdu.data)
+
+    # A modulus not matching p.q is rejected
+    other = RSA.generate(2048)
+    data = _rsa_header_list(key)
+    data = data[:-256] + long_to_bytes(other.n, 256)
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, data)
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+
+def test_import_ecc(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    key = ECC.generate(curve="P-256")
+    other = ECC.generate(curve="P-256")
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.set_template(DataObject.DO_SIG_ATTR, KEY_TEMPLATES["nistp256"])
+    assert rapdu.status == Errors.SW_OK
+
+    # Matching public point, checked against the private key
+    rapdu = client.put_data(DataObject.CMD_KEY_IMPORT,
+                            _ecc_header_list(key, key.pointQ, IMPORT_CHECK_PUBLIC))
+    assert rapdu.status == Errors.SW_OK
+    assert get_ECDSA_pub_key(client, DataObject.DO_SIG_KEY).pointQ == key.pointQ
+
+    # Point of another key: on the curve, but not matching
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT,
+                        _ecc_header_list(key, other.pointQ, IMPORT_CHECK_PUBLIC))
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+    # Point off the curve, always rejected
+    data = bytearray(_ecc_header_list(key, key.pointQ, None))
+    data[-1] ^= 0x01
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, bytes(data))
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+    # Options are only taken from their DO, not as a bare CRT content
+    data = _ecc_header_list(key, key.pointQ, None)
+    data = data.replace(b"\xb6\x00", b"\xb6\x01\x01", 1)
+    data = b"\x4d" + _length(len(data) - 2) + data[2:]
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, data)
+    assert err.value.status == Errors.SW_WRONG_DATA
+
+
+def test_import_length(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    key = RSA.generate(2048)
+    data = _rsa_header_list(key)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.set_template(DataObject.DO_SIG_ATTR, KEY_TEMPLATES["rsa2048"])
+    assert rapdu.status == Errors.SW_OK
+
+    # Truncated chain
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, data[:-10])
+    assert err.value.status == Errors.SW_WRONG_LENGTH
+
+    # Over-long chain
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, data + bytes(10))
+    assert err.value.status == Errors.SW_WRONG_LENGTH
+
+    # The exact chain is still accepted
+    rapdu = client.put_data(DataObject.CMD_KEY_IMPORT, data)
+    assert rapdu.status == Errors.SW_OK
+
+
+def test_import_access(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    key = RSA.generate(2048)
+
+    # PW3 (Admin) not verified
+    rapdu = client.send_verify_pw(PassWord.PW3, reset=True)
+    assert rapdu.status == Errors.SW_OK
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.CMD_KEY_IMPORT, _rsa_header_list(key))
+    assert err.value.status == Errors.SW_SECURITY_STATUS_NOT_SATISFIED
@@ -0,0 +1,137 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the key generation add-ons
+"""
+import hashlib
+from typing import Dict, Tuple
+
+from ragger.backend import BackendInterface
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode, KEY_TEMPLATES
+
+
+def _parse_tlv(data: bytes) -> Dict[int, bytes]:
+    """Parse a list of TLV with 1 or 2 bytes tags"""
+
+    tlv = {}
+    off = 0
+    while off < len(data):
+        tag = data[off]
+        off += 1
+        if tag & 0x1F == 0x1F:
+            tag = (tag << 8) | data[off]
+            off += 1
+        length = data[off]
+        off += 1
+        if length == 0x81:
+            length = data[off]
+            off += 1
+        elif length == 0x82:
+            length = int.from_bytes(data[off:off + 2], "big")
+            off += 2
+        tlv[tag] = data[off:off + length]
+        off += length
+    return tlv
+
+
+def _mpi(value: bytes) -> bytes:
+    """Encode an OpenPGP MPI"""
+
+    value = value.lstrip(b"\x00")
+    bits = (len(value) - 1) * 8 + value[0].bit_length()
+    return bits.to_bytes(2, "big") + value
+
+
+def _rsa_fingerprint(pubkey: Tuple[bytes, bytes], timestamp: int) -> bytes:
+    """Compute an RSA key v4 fingerprint"""
+
+    body = b"\x04" + timestamp.to_bytes(4, "big") + b"\x01"
+    body += _mpi(pubkey[0]) + _mpi(pubkey[1])
+    return hashlib.sha1(b"\x99" + len(body).to_bytes(2, "big") + body).digest()
+
+
+def test_gen_commit(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    timestamp = 0x65A0B1C2
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Generate the SIG Key Pair with the default RSA template
+    rapdu = client.generate_key_commit(DataObject.DO_SIG_KEY, timestamp)
+    assert rapdu.status == Errors.SW_OK
+
+    # Public key and fingerprint are returned together
+    tlv = _parse_tlv(rapdu.data)
+    pubkey = _parse_tlv(tlv[0x7F49])
+    fingerprint = _rsa_fingerprint((pubkey[0x81], pubkey[0x82]), timestamp)
+    assert tlv[0xC7] == fingerprint
+
+    # Fingerprint and date are stored
+    rapdu = client.get_data(DataObject.DO_APP_DATA)
+    assert rapdu.status == Errors.SW_OK
+    assert bytes([0xC5, 60]) + fingerprint in rapdu.data
+    assert bytes([0xCD, 12]) + timestamp.to_bytes(4, "big") in rapdu.data
+
+
+def test_gen_provision(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    timestamp = 0x65A0B1C2
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Generate the 3 Key Pairs of the current slot, with their fingerprints
+    rapdu = client.provision_keys(0x01, timestamp)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == bytes.fromhex("00b69000" "00b89000" "00a49000")
+
+    # Keys are the seeded ones, with fingerprints matching the public keys
+    rapdu = client.read_key(DataObject.DO_SIG_KEY)
+    assert rapdu.status == Errors.SW_OK
+    pubkey = _parse_tlv(_parse_tlv(rapdu.data)[0x7F49])
+    fingerprint = _rsa_fingerprint((pubkey[0x81], pubkey[0x82]), timestamp)
+    rapdu = client.generate_key(DataObject.DO_SIG_KEY, True)
+    assert rapdu.status == Errors.SW_OK
+    assert _parse_tlv(_parse_tlv(rapdu.data)[0x7F49])[0x81] == pubkey[0x81]
+    rapdu = client.get_data(DataObject.DO_APP_DATA)
+    assert rapdu.status == Errors.SW_OK
+    assert bytes([0xC5, 60]) + fingerprint in rapdu.data
+
+    # Slot mask is checked
+    rapdu = client.provision_keys(0x08)
+    assert rapdu.status == Errors.SW_WRONG_DATA
+
+
+def test_read_cached(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Generate an Ed25519 SIG Key Pair
+    rapdu = client.set_template(DataObject.DO_SIG_ATTR, KEY_TEMPLATES["ed25519"])
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.generate_key(DataObject.DO_SIG_KEY, True)
+    assert rapdu.status == Errors.SW_OK
+    pubkey = rapdu.data
+
+    # The public key template is returned from the cache
+    for _ in range(2):
+        rapdu = client.read_key(DataObject.DO_SIG_KEY)
+        assert rapdu.status == Errors.SW_OK
+        assert rapdu.data == pubkey
+
+    # A new template drops the cached public key
+    rapdu = client.set_template(DataObject.DO_SIG_ATTR, KEY_TEMPLATES["nistp256"])
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.read_key(DataObject.DO_SIG_KEY)
+    assert rapdu.data != pubkey
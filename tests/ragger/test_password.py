@@ -156,3 +156,23 @@ def test_challenge(backend: BackendInterface) -> None:
     rapdu = client.get_challenge(32)
     assert rapdu.status == Errors.SW_OK
     print(f"Random: {rapdu.data.hex()}")
+
+
+# In this test we check the Get Challenge with a large output
+def test_challenge_large(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Get Random number, larger than a single APDU
+    rapdu = client.get_challenge(1024)
+    assert rapdu.status == Errors.SW_OK
+    assert len(rapdu.data) == 1024
+
+    # Two consecutive outputs differ
+    rapdu2 = client.get_challenge(1024)
+    assert rapdu2.status == Errors.SW_OK
+    assert rapdu2.data != rapdu.data
+
+    # Too large
+    rapdu = client.get_challenge(1025)
+    assert rapdu.status == Errors.SW_WRONG_LENGTH
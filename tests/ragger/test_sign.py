@@ -9,12 +9,17 @@ from Crypto.PublicKey.RSA import RsaKey
 from Crypto.Signature import pkcs1_15
 from Crypto.Random import get_random_bytes
 
+import pytest
+from ledgered.devices import Device
+from ragger.error import ExceptionRAPDU
 from ragger.backend import BackendInterface
+from ragger.navigator import NavInsID, Navigator
 
 from application_client.command_sender import CommandSender
 from application_client.app_def import Errors, DataObject, PassWord, PubkeyAlgo
 
 from utils import check_pincode, get_key_attributes, get_RSA_pub_key, generate_key, SHA256_DIGEST_INFO
+from utils import KEY_TEMPLATES
 
 
 # In this test we check the key pair generation
@@ -44,6 +49,54 @@ def test_sign(backend: BackendInterface) -> None:
     _verify_signature(client, hash_obj, DataObject.DO_SIG_KEY, rapdu.data)
 
 
+# In this test we check the batch signature
+def test_sign_batch(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Generate the SIG Key Pair
+    generate_key(client, DataObject.DO_SIG_KEY)
+
+    # Verify PW1 (User)
+    check_pincode(client, PassWord.PW1)
+
+    # Hash data buffers
+    hash_objs = [SHA256.new(get_random_bytes(16)) for _ in range(4)]
+
+    rapdu = client.sign_batch([SHA256_DIGEST_INFO + h.digest() for h in hash_objs])
+    assert rapdu.status == Errors.SW_OK
+
+    # Verify the signatures
+    data = rapdu.data
+    for hash_obj in hash_objs:
+        size = int.from_bytes(data[:2], "big")
+        _verify_signature(client, hash_obj, DataObject.DO_SIG_KEY, data[2:2 + size])
+        data = data[2 + size:]
+    assert len(data) == 0
+
+
+# In this test we check a batch is refused when PW1 is valid for one signature
+def test_sign_batch_single_pw1(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Generate the SIG Key Pair
+    generate_key(client, DataObject.DO_SIG_KEY)
+
+    # PW1 valid for one PSO:CDS only
+    rapdu = client.put_data(DataObject.DO_PW_STATUS, b"\x00")
+    assert rapdu.status == Errors.SW_OK
+
+    # Verify PW1 (User)
+    check_pincode(client, PassWord.PW1)
+
+    # Hash data buffers
+    hash_objs = [SHA256.new(get_random_bytes(16)) for _ in range(2)]
+
+    rapdu = client.sign_batch([SHA256_DIGEST_INFO + h.digest() for h in hash_objs])
+    assert rapdu.status == Errors.SW_SECURITY_STATUS_NOT_SATISFIED
+
+
 # In this test we check the key pair generation
 def test_auth(backend: BackendInterface) -> None:
     # Use the app interface instead of raw interface
@@ -65,6 +118,68 @@ def test_auth(backend: BackendInterface) -> None:
     _verify_signature(client, hash_obj, DataObject.DO_AUT_KEY, rapdu.data)
 
 
+# In this test we check that one UIF confirmation approves a window of N signatures
+def test_sign_uif_window(device: Device,
+                         backend: BackendInterface,
+                         navigator: Navigator) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    window = 3
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # ECC SIG Key: the signature fits in a single response
+    rapdu = client.put_data(DataObject.DO_SIG_ATTR, bytes.fromhex(KEY_TEMPLATES["nistp256"]))
+    assert rapdu.status == Errors.SW_OK
+    generate_key(client, DataObject.DO_SIG_KEY)
+
+    # Enable UIF, one confirmation approving N operations
+    rapdu = client.put_data(DataObject.DO_UIF_SIG, bytes([1, window]))
+    assert rapdu.status == Errors.SW_OK
+
+    # Verify PW1 (User)
+    check_pincode(client, PassWord.PW1)
+
+    digest = SHA256.new(get_random_bytes(16)).digest()
+
+    # The first signature prompts, and opens the window
+    with client.sign_with_confirmation(digest):
+        _confirm(device, navigator, True)
+    response = client.get_async_response()
+    assert response and response.status == Errors.SW_OK
+
+    # The next N-1 signatures don't prompt
+    for _ in range(window - 1):
+        rapdu = client.sign(digest)
+        assert rapdu.status == Errors.SW_OK
+
+    # The window is exhausted: the N+1th signature prompts again
+    with pytest.raises(ExceptionRAPDU) as err:
+        with client.sign_with_confirmation(digest):
+            _confirm(device, navigator, False)
+    assert err.value.status == Errors.SW_SECURITY
+
+
+def _confirm(device: Device, navigator: Navigator, accept: bool) -> None:
+    # No screenshot comparison, only check the prompt is displayed
+    if device.is_nano:
+        text = "Yes" if accept else "No"
+        nav_inst = NavInsID.RIGHT_CLICK
+        valid_instr = [NavInsID.BOTH_CLICK]
+    else:
+        text = "Confirm"
+        nav_inst = NavInsID.USE_CASE_CHOICE_CONFIRM
+        if accept:
+            valid_instr = [NavInsID.USE_CASE_CHOICE_CONFIRM]
+        else:
+            valid_instr = [NavInsID.USE_CASE_CHOICE_REJECT]
+    navigator.navigate_until_text(nav_inst,
+                                  valid_instr,
+                                  text,
+                                  screen_change_after_last_instruction=False)
+
+
 def _verify_signature(client: CommandSender,
                       hash_obj: SHA256.SHA256Hash,
                       key_tag: DataObject,
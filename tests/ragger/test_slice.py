@@ -0,0 +1,104 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the partial DO read feature
+"""
+import pytest
+
+from ragger.backend import BackendInterface
+from ragger.error import ExceptionRAPDU
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode
+
+
+def test_get_data_slice(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    url = b"https://slice.example/" + bytes(range(0x41, 0x5B)) * 8
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.put_data(DataObject.DO_URL, url)
+    assert rapdu.status == Errors.SW_OK
+
+    # Read a slice, then the following ones
+    rapdu = client.get_data_slice(DataObject.DO_URL, 8, 16)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == url[8:24]
+    rapdu = client.get_data_slice(DataObject.DO_URL, None, 16)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == url[24:40]
+
+    # Resume up to the end
+    rapdu = client.get_data_slice(DataObject.DO_URL, 100)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == url[100:]
+
+    # Offset outside of the DO
+    rapdu = client.get_data_slice(DataObject.DO_URL, len(url) + 1, 16)
+    assert rapdu.status == Errors.SW_WRONG_P1P2
+
+    # The archive is streamed, no slice of it
+    rapdu = client.get_data_slice(DataObject.CMD_ARCHIVE, 0, 16)
+    assert rapdu.status == Errors.SW_CONDITIONS_NOT_SATISFIED
+
+    # Slices of other DOs are still served
+    rapdu = client.get_data_slice(DataObject.DO_URL, 0, 16)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == url[:16]
+
+
+def test_get_data_nvm(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    login = bytes(range(256)) + bytes(range(255, -1, -1))
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.put_data(DataObject.DO_LOGIN, login)
+    assert rapdu.status == Errors.SW_OK
+
+    # Whole DO, sent from NVM over several responses
+    rapdu = client.get_data_slice(DataObject.DO_LOGIN, 0)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == login
+
+    # Slice in the middle of the DO
+    rapdu = client.get_data_slice(DataObject.DO_LOGIN, 200, 250)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == login[200:450]
+
+
+def test_put_data_cert(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+    cert = bytes(range(256)) * 10
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+
+    # Larger than the io buffer, written to the heap as received
+    rapdu = client.put_data(DataObject.DO_CERT, cert)
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.get_data_slice(DataObject.DO_CERT, 0)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == cert
+
+    # Too long: the previous certificate is kept
+    with pytest.raises(ExceptionRAPDU) as err:
+        client.put_data(DataObject.DO_CERT, cert + b"\x00")
+    assert err.value.status == Errors.SW_WRONG_LENGTH
+    rapdu = client.get_data_slice(DataObject.DO_CERT, 0)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == cert
+
+    # Replace it by a shorter one
+    rapdu = client.put_data(DataObject.DO_CERT, cert[:300])
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.get_data_slice(DataObject.DO_CERT, 0)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == cert[:300]
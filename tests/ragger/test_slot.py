@@ -50,3 +50,43 @@ def test_slot(backend: BackendInterface) -> None:
     # Read an empty pub key
     rapdu = client.read_key(DataObject.DO_SIG_KEY)
     assert rapdu.status == Errors.SW_REFERENCED_DATA_NOT_FOUND
+
+
+def test_slot_url(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Check slots availability
+    nb_slots, _ = client.get_slot_config()
+    if nb_slots == 1:
+        pytest.skip("single slot configuration")
+
+    # Write the URL of slot 0
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.put_data(DataObject.DO_URL, b"https://slot0.example")
+    assert rapdu.status == Errors.SW_OK
+
+    # Change slot
+    check_pincode(client, PassWord.PW2)
+    rapdu = client.set_slot(1)
+    assert rapdu.status == Errors.SW_OK
+
+    # The URL is bound to the slot
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == b""
+
+    # Rewrite the slot 1 URL with another length
+    check_pincode(client, PassWord.PW3)
+    rapdu = client.put_data(DataObject.DO_URL, b"https://slot1.example/" + b"a" * 200)
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.put_data(DataObject.DO_URL, b"https://slot1.example")
+    assert rapdu.status == Errors.SW_OK
+
+    # Back to slot 0
+    check_pincode(client, PassWord.PW2)
+    rapdu = client.set_slot(0)
+    assert rapdu.status == Errors.SW_OK
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.status == Errors.SW_OK
+    assert rapdu.data == b"https://slot0.example"
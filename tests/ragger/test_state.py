@@ -0,0 +1,67 @@
+# -*- coding: utf-8 -*-
+# SPDX-FileCopyrightText: 2024 Ledger SAS
+# SPDX-License-Identifier: LicenseRef-LEDGER
+"""
+This module provides Ragger tests for the card state counter
+"""
+import pytest
+
+from ragger.backend import BackendInterface
+from ragger.error import ExceptionRAPDU
+
+from application_client.command_sender import CommandSender
+from application_client.app_def import Errors, DataObject, PassWord
+
+from utils import check_pincode, generate_key
+
+
+def get_counter(client: CommandSender) -> int:
+    rapdu = client.get_data(DataObject.CMD_STATE_COUNTER)
+    assert rapdu.status == Errors.SW_OK
+    assert len(rapdu.data) == 4
+    return int.from_bytes(rapdu.data, "big")
+
+
+def test_state_counter(backend: BackendInterface) -> None:
+    # Use the app interface instead of raw interface
+    client = CommandSender(backend)
+
+    # Reads do not change the counter
+    counter = get_counter(client)
+    rapdu = client.get_data(DataObject.DO_URL)
+    assert rapdu.status == Errors.SW_OK
+    assert get_counter(client) == counter
+
+    # Verify PW3 (Admin)
+    check_pincode(client, PassWord.PW3)
+    assert get_counter(client) == counter
+
+    # PUT DATA
+    rapdu = client.put_data(DataObject.DO_URL, b"https://state.example")
+    assert rapdu.status == Errors.SW_OK
+    assert get_counter(client) > counter
+    counter = get_counter(client)
+
+    # Rejected PUT DATA
+    with pytest.raises(ExceptionRAPDU):
+        client.put_data(DataObject.DO_UIF_SIG, bytes(3))
+    assert get_counter(client) == counter
+
+    # RAM only vendor DO
+    check_pincode(client, PassWord.PW2)
+    rapdu = client.put_data(DataObject.CMD_ECDH_CACHE, b"\x02")
+    assert rapdu.status == Errors.SW_OK
+    assert get_counter(client) == counter
+
+    # Key generation
+    generate_key(client, DataObject.DO_SIG_KEY)
+    assert get_counter(client) > counter
+    counter = get_counter(client)
+
+    # Slot selection
+    nb_slots, _ = client.get_slot_config()
+    if nb_slots > 1:
+        check_pincode(client, PassWord.PW2)
+        rapdu = client.set_slot(1)
+        assert rapdu.status == Errors.SW_OK
+        assert get_counter(client) > counter
@@ -46,8 +46,61 @@ static void test_io(void **state) {
     assert_int_equal(gpg_io_fetch_u32(), v32);
 }
 
+static void test_io_clear(void **state) {
+    (void) state;
+
+    unsigned char zero[GPG_IO_BUFFER_LENGTH] = {0};
+    unsigned char data[16];
+
+    memset(data, 0xA5, sizeof(data));
+
+    // Only the written extent is tracked
+    gpg_io_insert(data, sizeof(data));
+    gpg_io_insert_u16(0x9000);
+    assert_int_equal(G_gpg_vstate.io_dirty, sizeof(data) + 2);
+
+    gpg_io_discard(1);
+    assert_int_equal(G_gpg_vstate.io_dirty, 0);
+    assert_memory_equal(G_gpg_vstate.work.io_buffer, zero, GPG_IO_BUFFER_LENGTH);
+
+    // Data written out of the message is wiped once the area is tainted
+    G_gpg_vstate.work.io_buffer[GPG_IO_BUFFER_LENGTH - 1] = 0x5A;
+    gpg_io_taint();
+    gpg_io_discard(1);
+    assert_int_equal(G_gpg_vstate.io_dirty, 0);
+    assert_memory_equal(G_gpg_vstate.work.io_buffer, zero, GPG_IO_BUFFER_LENGTH);
+}
+
+static void test_io_scratch(void **state) {
+    (void) state;
+
+    unsigned char zero[64] = {0};
+    unsigned int mark;
+    unsigned char *a, *b;
+
+    // Scratch areas are stacked from the buffer end
+    mark = gpg_io_scratch_mark();
+    a = gpg_io_scratch_alloc(30);
+    assert_ptr_equal(a, G_gpg_vstate.work.io_buffer + GPG_IO_BUFFER_LENGTH - 32);
+    b = gpg_io_scratch_alloc(16);
+    assert_ptr_equal(b, a - 16);
+    memset(b, 0xA5, 48);
+
+    // Message data does not move
+    gpg_io_insert_u32(0x12345678);
+    gpg_io_set_offset(0);
+    assert_int_equal(gpg_io_fetch_u32(), 0x12345678);
+
+    // Release wipes the areas
+    gpg_io_scratch_release(mark);
+    assert_int_equal(G_gpg_vstate.scratch_used, 0);
+    assert_memory_equal(b, zero, 48);
+}
+
 int main() {
-    const struct CMUnitTest tests[] = {cmocka_unit_test_setup(test_io, setup)};
+    const struct CMUnitTest tests[] = {cmocka_unit_test_setup(test_io, setup),
+                                       cmocka_unit_test_setup(test_io_clear, setup),
+                                       cmocka_unit_test_setup(test_io_scratch, setup)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }